@@ -1,49 +1,97 @@
+/*
+ * The arena allocator maps its memory on Linux, so that it can ask for huge pages.
+ * Define JSON_NO_MMAP to have it use malloc instead.
+ */
+#if defined(__linux__) && !defined(JSON_NO_MMAP)
+#define JSON_USE_MMAP
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#endif
+
+/*
+ * Whitespace is skipped 16 bytes at a time, and the digits of numbers converted
+ * 8 at a time, with SSE2 where the target has it. Targets built for AVX2,
+ * e.g. with -mavx2 or /arch:AVX2, skip whitespace 32 bytes at a time.
+ * Define JSON_NO_SIMD to use the portable code instead.
+ */
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(JSON_NO_SIMD)
+#define JSON_USE_SSE2
+#if defined(__AVX2__)
+#define JSON_USE_AVX2
+#endif
+#endif
+
 #include "json.h"
+#include "json_static.h"
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <float.h>
-
-typedef struct JSONNumber JSONNumber;
-typedef struct JSONString JSONString;
+#include <limits.h>
+#ifdef JSON_USE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef JSON_USE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef JSON_USE_AVX2
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 /*
- * JSONValue is defined to just hold the type as it is
- * not supposed to be constructed on its own, but dynamically allocated
- * as different objects as identified by the tag, which
- * it can then be cast to at runtime.
+ * Reference counts and the lookup hints of shapes may be changed from
+ * several threads at once, e.g. by the tasks of the parallel functions.
+ * GCC and Clang use their atomic builtins, and MSVC its interlocked
+ * intrinsics, picking the 32 or 64 bit one by the size of the operand.
+ * Other compilers fall back to plain arithmetic, where that isn't safe.
  */
-struct JSONValue {
-	JSONType type;
-};
-
-struct JSONNumber {
-	JSONValue value;
-	double number;
-};
-
-struct JSONString {
-	JSONValue value;
-	char * string;
-};
-
-struct JSONArray {
-	JSONValue value;
-	JSONValue ** values;
-	size_t size;
-};
+#if defined(__GNUC__)
+#define ATOMIC_INCREMENT(x) __sync_add_and_fetch(&(x), 1)
+#define ATOMIC_DECREMENT(x) __sync_sub_and_fetch(&(x), 1)
+#define ATOMIC_COMPARE_SWAP(x, old, new) __sync_bool_compare_and_swap(&(x), old, new)
+#define ATOMIC_EXCHANGE(x, new) __sync_lock_test_and_set(&(x), new)
+#define ATOMIC_LOAD_RELAXED(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define ATOMIC_STORE_RELAXED(x, new) __atomic_store_n(&(x), new, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD_ACQUIRE(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#elif defined(_MSC_VER)
+#ifdef _WIN64
+#define MSVC_ATOMIC(x, op64, op32) (sizeof(x) == 8 ? (unsigned __int64)op64 : (unsigned long)op32)
+#else
+#define MSVC_ATOMIC(x, op64, op32) ((unsigned long)op32)
+#endif
+#define ATOMIC_INCREMENT(x) MSVC_ATOMIC(x, _InterlockedIncrement64((__int64 volatile *)&(x)), _InterlockedIncrement((long volatile *)&(x)))
+#define ATOMIC_DECREMENT(x) MSVC_ATOMIC(x, _InterlockedDecrement64((__int64 volatile *)&(x)), _InterlockedDecrement((long volatile *)&(x)))
+#define ATOMIC_COMPARE_SWAP(x, old, new) (_InterlockedCompareExchangePointer((void * volatile *)&(x), new, old) == (void *)(old))
+#define ATOMIC_EXCHANGE(x, new) _InterlockedExchangePointer((void * volatile *)&(x), new)
+/* aligned loads and stores of a word are atomic on the targets of MSVC */
+#define ATOMIC_LOAD_RELAXED(x) (sizeof(x) == 8 ? (unsigned __int64)*(__int64 volatile *)&(x) : (unsigned long)*(long volatile *)&(x))
+#define ATOMIC_STORE_RELAXED(x, new) (sizeof(x) == 8 ? (void)(*(__int64 volatile *)&(x) = (__int64)(new)) \
+	: (void)(*(long volatile *)&(x) = (long)(new)))
+#define ATOMIC_LOAD_ACQUIRE(x) MSVC_ATOMIC(x, _InterlockedOr64((__int64 volatile *)&(x), 0), _InterlockedOr((long volatile *)&(x), 0))
+#else
+#define ATOMIC_INCREMENT(x) (++(x))
+#define ATOMIC_DECREMENT(x) (--(x))
+#define ATOMIC_COMPARE_SWAP(x, old, new) ((x) == (old) ? ((x) = (new), 1) : 0)
+#define ATOMIC_EXCHANGE(x, new) atomic_exchange_fallback((void **)&(x), new)
+#define ATOMIC_LOAD_RELAXED(x) (x)
+#define ATOMIC_STORE_RELAXED(x, new) ((x) = (new))
+#define ATOMIC_LOAD_ACQUIRE(x) (x)
 
-struct JSONObject {
-	JSONValue value;
-	char ** strings;
-	JSONValue ** values;
-	size_t count;
-};
+static void * atomic_exchange_fallback(void ** x, void * new) {
+	void * old = *x;
+	*x = new;
+	return old;
+}
+#endif
 
-static JSONValue json_null = { JSON_NULL };
-static JSONValue json_true = { JSON_BOOL };
-static JSONValue json_false = { JSON_BOOL };
+JSONValue json_null = { JSON_NULL, 0, 0 };
+JSONValue json_true = { JSON_BOOL, 0, 0 };
+JSONValue json_false = { JSON_BOOL, 0, 0 };
 
 typedef enum {
 	TT_NULL,
@@ -67,6 +115,7 @@ typedef struct {
 		double number;
 		char * string;
 	} as;
+	size_t length; /* of the string */
 } Token;
 
 static Token error_token(void) {
@@ -83,10 +132,32 @@ typedef struct {
 } Lexer;
 
 #define MAX_DOUBLE_DIGITS (3 + DBL_MANT_DIG - DBL_MIN_EXP)
+/* containers nested deeper share the hints of the deepest level */
+#define CTX_HINT_DEPTHS 32
+
+/* an open addressed table of canonical values, see deduper_intern */
+typedef struct {
+	JSONAllocator allocator;
+	JSONValue ** values;
+	unsigned long * hashes;
+	size_t capacity;
+	size_t count;
+} Deduper;
 
 typedef struct {
 	Lexer lexer;
 	JSONAllocator allocator;
+	const JSONParseOptions * options;
+	JSONShape ** shapes; /* open addressed table of the shapes seen during this parse */
+	size_t shape_capacity;
+	size_t shape_count;
+	Deduper deduper; /* of the values parsed so far, when options->dedup is set */
+	unsigned long raw_live; /* the raw paths leading to the object being parsed */
+	size_t raw_level; /* the segment of those paths its keys are matched against */
+	const char * token_begin; /* where the last token from next_token starts */
+	size_t depth; /* of the container being parsed */
+	size_t array_hints[CTX_HINT_DEPTHS]; /* the usual sizes of arrays and objects at each depth */
+	size_t object_hints[CTX_HINT_DEPTHS];
 	char double_buffer[MAX_DOUBLE_DIGITS];
 } Ctx;
 
@@ -95,11 +166,18 @@ static void * ctx_reallocate(Ctx * ctx, void * old_alloc, size_t old_size, size_
 }
 
 static void allocator_free(void * old_alloc, size_t old_size, JSONAllocator allocator) {
+	/* callbacks are not expected to handle (_, NULL, _, 0) */
+	if (!old_alloc || (allocator.flags & JSON_ALLOCATOR_FREE_NOOP)) {
+		return;
+	}
 	allocator.callback(allocator.ctx, old_alloc, old_size, 0);
 }
 
 static void allocator_free_array(void * old_alloc, size_t old_size, size_t element_size, JSONAllocator allocator) {
 	/* old_size * element_size should never be given the chance to overflow */
+	if (!old_alloc || (allocator.flags & JSON_ALLOCATOR_FREE_NOOP)) {
+		return;
+	}
 	allocator.callback(allocator.ctx, old_alloc, old_size * element_size, 0);
 }
 
@@ -125,6 +203,10 @@ static int c_is_digit(char c) {
 	return '0' <= c && c <= '9';
 }
 
+static int c_is_space(char c) {
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v';
+}
+
 static int lexer_eof(const Lexer * lexer) {
 	return lexer->begin == lexer->end;
 }
@@ -143,142 +225,448 @@ static void lexer_advance(Lexer * lexer) {
 	}
 }
 
-static int try_append_unverified_codepoint(Ctx * ctx, char ** str, size_t * size, unsigned long codepoint) {
-	char * new_str;
-	char * start;
+#if ULONG_MAX >> 31 >> 31 >= 3
+/*
+ * Eight bytes at a time, when unsigned long has 64 bits.
+ * The bytes are assembled in little endian order, which compilers turn into one load.
+ */
+#define SWAR_64
+#ifndef JSON_USE_SSE2
+static unsigned long swar_load(const char * p) {
+	const unsigned char * bytes = (const unsigned char *)p;
+	return (unsigned long)bytes[0] | (unsigned long)bytes[1] << 8
+		| (unsigned long)bytes[2] << 16 | (unsigned long)bytes[3] << 24
+		| (unsigned long)bytes[4] << 32 | (unsigned long)bytes[5] << 40
+		| (unsigned long)bytes[6] << 48 | (unsigned long)bytes[7] << 56;
+}
+
+/* sets the high bit of each byte of chunk that isn't c */
+static unsigned long swar_bytes_not(unsigned long chunk, unsigned char c) {
+	unsigned long x = chunk ^ (0x0101010101010101UL * c);
+	return ((x & 0x7F7F7F7F7F7F7F7FUL) + 0x7F7F7F7F7F7F7F7FUL) | x;
+}
+#endif
+#endif
+
+#if defined(JSON_USE_SSE2) || defined(SWAR_64)
+/* the index of the lowest set bit of a nonzero mask */
+static unsigned int lowest_bit(unsigned long mask) {
+#if defined(__GNUC__)
+	return __builtin_ctzl(mask);
+#else
+	unsigned int i = 0;
+	for (; !(mask & 1); mask >>= 1) {
+		++i;
+	}
+	return i;
+#endif
+}
+#endif
+
+/* runs of whitespace shorter than this are quicker to step through than to compare in blocks */
+#define WHITESPACE_SHORT_RUN 8
+
+/* the block comparison is kept out of line, so that the usual short runs don't pay for setting it up */
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+/*
+ * Skips the rest of a run of whitespace. Indentation repeats one character, so a block
+ * is compared against the character at p, finding where that character's run ends.
+ */
+static NOINLINE const char * skip_whitespace_run(const char * p, const char * end) {
+	const char * short_end = end - p > WHITESPACE_SHORT_RUN ? p + WHITESPACE_SHORT_RUN : end;
+	while (p < short_end && c_is_space(*p)) {
+		++p;
+	}
+	while (p < end && c_is_space(*p)) {
+		/* blocks of the same character are skipped without waiting for the last one's result */
+		const char * start = p;
+#if defined(JSON_USE_AVX2)
+		__m256i wide = _mm256_set1_epi8(*p);
+		unsigned long wide_others = 0;
+		while (end - p >= 32 && !(wide_others = ~(unsigned long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), wide)) & 0xFFFFFFFFUL)) {
+			p += 32;
+		}
+		if (wide_others) {
+			p += lowest_bit(wide_others);
+			continue;
+		}
+#endif
+#if defined(JSON_USE_SSE2)
+		{
+			__m128i repeated = _mm_set1_epi8(*p);
+			unsigned int others = 0;
+			while (end - p >= 16 && !(others = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), repeated)) & 0xFFFF)) {
+				p += 16;
+			}
+			if (others) {
+				p += lowest_bit(others);
+				continue;
+			}
+		}
+#elif defined(SWAR_64)
+		{
+			unsigned char c = *p;
+			unsigned long others = 0;
+			while (end - p >= 8 && !(others = swar_bytes_not(swar_load(p), c) & 0x8080808080808080UL)) {
+				p += 8;
+			}
+			if (others) {
+				p += lowest_bit(others) / 8;
+				continue;
+			}
+		}
+#endif
+		/* less than a block is left, and if none was skipped, the character is stepped over */
+		if (p == start) {
+			++p;
+		}
+	}
+	return p;
+}
+
+/*
+ * The scanner walks the input without allocating any JSONValues,
+ * for the functions that only need to look at parts of a document.
+ * A Span holds the raw text of a token; for strings that is the
+ * contents between the quotes, with escape sequences left undecoded.
+ */
+typedef struct {
+	TokenType type;
+	const char * begin;
+	const char * end;
+	int escaped;
+} Span;
+
+/* compact documents have a byte of whitespace between tokens at most, which is checked for first */
+static void scan_whitespace(Lexer * lexer) {
+	const char * p = lexer->begin;
+	if (p < lexer->end && c_is_space(*p)) {
+		++p;
+		if (p < lexer->end && c_is_space(*p)) {
+			p = skip_whitespace_run(p, lexer->end);
+		}
+		lexer->begin = p;
+	}
+}
+
+/* expects the opening quote to be consumed already */
+static int scan_rest_of_string(Lexer * lexer, Span * span) {
+	span->type = TT_STRING;
+	span->begin = lexer->begin;
+	span->escaped = 0;
+	while (!lexer_eof(lexer)) {
+		char c = *lexer->begin++;
+		if (c == '"') {
+			span->end = lexer->begin - 1;
+			return 1;
+		}
+		if (c == '\0') {
+			break;
+		}
+		if (c == '\\') {
+			span->escaped = 1;
+			if (lexer_eof(lexer)) {
+				break;
+			}
+			++lexer->begin;
+		}
+	}
+	return 0;
+}
+
+/* writes the UTF-8 encoding of codepoint to out, returning its length or 0 if it is invalid */
+static size_t encode_unverified_codepoint(char * out, unsigned long codepoint) {
 	if (codepoint < 0x0020 || codepoint > 0x10FFFF) {
 		return 0;
 	}
 	if (codepoint < 0x80) {
-		new_str = ctx_reallocate(ctx, *str, *size, *size + 1);
-		if (!new_str) {
-			return 0;
-		}
-		new_str[*size] = codepoint;
-		*str = new_str;
-		++*size;
+		out[0] = codepoint;
 		return 1;
 	}
 	if (codepoint < 0x800) {
-		new_str = ctx_reallocate(ctx, *str, *size, *size + 2);
-		if (!new_str) {
-			return 0;
-		}
-		start = new_str + *size;
-		start[0] = 0xC0 | ((codepoint >> 6) & 0x1F);
-		start[1] = 0x80 | (codepoint & 0x3F);
-		*str = new_str;
-		*size += 2;
-		return 1;
+		out[0] = 0xC0 | ((codepoint >> 6) & 0x1F);
+		out[1] = 0x80 | (codepoint & 0x3F);
+		return 2;
 	}
 	if (codepoint < 0x10000) {
 		if (codepoint >= 0xD800 && codepoint <= 0xDFFF) {
 			return 0;
 		}
-		new_str = ctx_reallocate(ctx, *str, *size, *size + 3);
-		if (!new_str) {
-			return 0;
-		}
-		start = new_str + *size;
-		start[0] = 0xE0 | ((codepoint >> 12) & 0x0F);
-		start[1] = 0x80 | ((codepoint >> 6) & 0x3F);
-		start[2] = 0x80 | (codepoint & 0x3F);
-		*str = new_str;
-		*size += 3;
-		return 1;
+		out[0] = 0xE0 | ((codepoint >> 12) & 0x0F);
+		out[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+		out[2] = 0x80 | (codepoint & 0x3F);
+		return 3;
 	}
 	/* codepoint >= 0x10000 */
-	new_str = ctx_reallocate(ctx, *str, *size, *size + 4);
-	if (!new_str) {
+	out[0] = 0xF0 | ((codepoint >> 18) & 0x07);
+	out[1] = 0x80 | ((codepoint >> 12) & 0x3F);
+	out[2] = 0x80 | ((codepoint >> 6) & 0x3F);
+	out[3] = 0x80 | (codepoint & 0x3F);
+	return 4;
+}
+
+/* decodes the escape sequence after a backslash into out, returning its length or 0 if it is invalid */
+static size_t decode_escape(Lexer * lexer, char * out) {
+	switch (lexer_next(lexer)) {
+	case 'b':
+		*out = '\b';
+		return 1;
+	case 'f':
+		*out = '\f';
+		return 1;
+	case 'n':
+		*out = '\n';
+		return 1;
+	case 'r':
+		*out = '\r';
+		return 1;
+	case '"':
+		*out = '"';
+		return 1;
+	case '\\':
+		*out = '\\';
+		return 1;
+	case '/':
+		*out = '/';
+		return 1;
+	case 'u': {
+		unsigned long codepoint = 0;
+		size_t i;
+		for (i = 0; i < 4; i++) {
+			char c = lexer_next(lexer);
+			codepoint <<= 4;
+			if (c_is_digit(c)) {
+				codepoint |= c - '0';
+			} else if ('a' <= c && c <= 'f') {
+				codepoint |= c - 'a' + 10;
+			} else if ('A' <= c && c <= 'F') {
+				codepoint |= c - 'A' + 10;
+			} else {
+				return 0;
+			}
+		}
+		return encode_unverified_codepoint(out, codepoint);
+	}
+	default:
 		return 0;
 	}
-	start = new_str + *size;
-	start[0] = 0xF0 | ((codepoint >> 18) & 0x07);
-	start[1] = 0x80 | ((codepoint >> 12) & 0x3F);
-	start[2] = 0x80 | ((codepoint >> 6) & 0x3F);
-	start[3] = 0x80 | (codepoint & 0x3F);
-	*str = new_str;
-	*size += 4;
-	return 1;
 }
 
-static Token lex_rest_of_string(Ctx * ctx) {
-	char * str = NULL;
-	char * new_str;
+/* decodes the escapes in the string between begin and end into out, returning the decoded size or (size_t)-1 */
+static size_t decode_escapes(const char * begin, const char * end, char * out) {
+	Lexer lexer = lexer_new(begin, end - begin);
 	size_t size = 0;
-	char c;
-	Token token;
-	while ((c = lexer_next(&ctx->lexer)) != '"') {
-		if (c == '\0') goto error;
+	while (!lexer_eof(&lexer)) {
+		char c = lexer_next(&lexer);
 		if (c == '\\') {
-			switch (lexer_next(&ctx->lexer)) {
-			case 'b':
-				c = '\b';
-				break;
-			case 'f':
-				c = '\f';
-				break;
-			case 'n':
-				c = '\n';
-				break;
-			case 'r':
-				c = '\r';
-				break;
-			case '"':
-				c = '"';
-				break;
-			case '\\':
-				c = '\\';
-				break;
-			case '/':
-				c = '/';
-				break;
-			case 'u': {
-				unsigned long codepoint = 0;
-				size_t i;
-				for (i = 0; i < 4; i++) {
-					char c = lexer_next(&ctx->lexer);
-					codepoint <<= 4;
-					if (c_is_digit(c)) {
-						codepoint |= c - '0';
-					} else if ('a' <= c && c <= 'f') {
-						codepoint |= c - 'a' + 10;
-					} else if ('A' <= c && c <= 'F') {
-						codepoint |= c - 'A' + 10;
-					} else {
-						goto error;
-					}
-				}
-				if (!try_append_unverified_codepoint(ctx, &str, &size, codepoint)) {
-					goto error;
-				}
-				goto outer;
-			}
-			default:
-					goto error;
+			size_t length = decode_escape(&lexer, out + size);
+			if (length == 0) {
+				return (size_t)-1;
 			}
+			size += length;
+			continue;
 		}
-		new_str = ctx_reallocate(ctx, str, size, size + 1);
-		if (!new_str) {
-			goto error;
+		out[size++] = c;
+	}
+	return size;
+}
+
+/* checks the escapes in the string between begin and end as decode_escapes would, without decoding it */
+static int escapes_valid(const char * begin, const char * end) {
+	Lexer lexer = lexer_new(begin, end - begin);
+	char decoded[4];
+	while (!lexer_eof(&lexer)) {
+		if (lexer_next(&lexer) == '\\' && decode_escape(&lexer, decoded) == 0) {
+			return 0;
 		}
-		str = new_str;
-		str[size] = c;
-		++size;
-outer:;
 	}
-	new_str = ctx_reallocate(ctx, str, size, size + 1);
-	if (!new_str) {
-		goto error;
+	return 1;
+}
+
+/*
+ * The string is scanned to its closing quote first, so that it can be allocated once.
+ * Escapes never decode to more bytes than they take up, so the raw length is enough,
+ * and the allocation is only shrunk when escapes made the string shorter.
+ */
+static Token lex_rest_of_string(Ctx * ctx) {
+	Lexer scan = ctx->lexer;
+	Span span;
+	size_t capacity;
+	size_t size;
+	char * str;
+	Token token;
+	if (!scan_rest_of_string(&scan, &span)) {
+		return ERROR_TOKEN;
+	}
+	capacity = span.end - span.begin;
+	str = ctx_reallocate(ctx, NULL, 0, capacity + 1);
+	if (!str) {
+		return ERROR_TOKEN;
+	}
+	if (!span.escaped) {
+		memcpy(str, span.begin, capacity);
+		size = capacity;
+	} else {
+		size = decode_escapes(span.begin, span.end, str);
+		if (size == (size_t)-1) {
+			allocator_free(str, capacity + 1, ctx->allocator);
+			return ERROR_TOKEN;
+		}
+		if (size < capacity) {
+			char * fitted = ctx_reallocate(ctx, str, capacity + 1, size + 1);
+			if (!fitted) {
+				allocator_free(str, capacity + 1, ctx->allocator);
+				return ERROR_TOKEN;
+			}
+			str = fitted;
+		}
 	}
-	str = new_str;
 	str[size] = '\0';
+	ctx->lexer = scan;
 	token.type = TT_STRING;
 	token.as.string = str;
+	token.length = size;
 	return token;
-error:
-	allocator_free(str, size, ctx->allocator);
-	return ERROR_TOKEN;
+}
+
+/*
+ * The fast path for numbers converts those with at most 15 significant digits
+ * and a small exponent itself: the digits are exact in a double, and so is
+ * a power of ten up to 1e22, so one multiplication or division rounds correctly.
+ * Other numbers, and those it can't vouch for, are left to lex_number.
+ */
+#define FAST_MAX_DIGITS 15
+#define FAST_MAX_EXPONENT 22
+
+static const double fast_powers[FAST_MAX_EXPONENT + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* with excess precision, the result would be rounded twice */
+#if defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ != 0
+#define FAST_NUMBERS 0
+#else
+#define FAST_NUMBERS 1
+#endif
+
+#if defined(JSON_USE_SSE2)
+/* eight digits at a time, combined in pairs and then quadruples by multiply-adds of 16 bit lanes */
+static int eight_digits(const char * p, unsigned long * value) {
+	__m128i digits = _mm_sub_epi8(_mm_loadl_epi64((const __m128i *)p), _mm_set1_epi8('0'));
+	__m128i invalid = _mm_or_si128(_mm_cmplt_epi8(digits, _mm_setzero_si128()), _mm_cmpgt_epi8(digits, _mm_set1_epi8(9)));
+	__m128i pairs;
+	__m128i quadruples;
+	if (_mm_movemask_epi8(invalid) & 0xFF) {
+		return 0;
+	}
+	pairs = _mm_madd_epi16(_mm_unpacklo_epi8(digits, _mm_setzero_si128()), _mm_set_epi16(1, 10, 1, 10, 1, 10, 1, 10));
+	quadruples = _mm_madd_epi16(_mm_packs_epi32(pairs, pairs), _mm_set_epi16(1, 100, 1, 100, 1, 100, 1, 100));
+	*value = (unsigned long)_mm_cvtsi128_si32(quadruples) * 10000 + (unsigned long)_mm_cvtsi128_si32(_mm_srli_si128(quadruples, 4));
+	return 1;
+}
+#define EIGHT_DIGITS 8
+#elif defined(SWAR_64)
+/* eight digits at a time */
+static int eight_digits(const char * p, unsigned long * value) {
+	unsigned long chunk = swar_load(p);
+	/* every byte is 0x30 to 0x39 */
+	if ((chunk & 0xF0F0F0F0F0F0F0F0UL) != 0x3030303030303030UL
+			|| ((chunk + 0x0606060606060606UL) & 0xF0F0F0F0F0F0F0F0UL) != 0x3030303030303030UL) {
+		return 0;
+	}
+	chunk -= 0x3030303030303030UL;
+	/* pairs, then quadruples of digits, combined with multiply-adds */
+	chunk = chunk * 10 + (chunk >> 8);
+	*value = ((chunk & 0x000000FF000000FFUL) * (100 + (1000000UL << 32))
+		+ ((chunk >> 16) & 0x000000FF000000FFUL) * (1 + (10000UL << 32))) >> 32;
+	return 1;
+}
+#define EIGHT_DIGITS 8
+#else
+static int eight_digits(const char * p, unsigned long * value) {
+	(void)p;
+	(void)value;
+	return 0;
+}
+#define EIGHT_DIGITS 0
+#endif
+
+/* reads a run of digits into mantissa, counting them in *digits (leading zeros of the mantissa aside) */
+static const char * fast_digits(const char * p, const char * end, double * mantissa, int * digits) {
+	unsigned long chunk;
+	while (EIGHT_DIGITS && end - p >= 8 && *digits + 8 <= FAST_MAX_DIGITS && eight_digits(p, &chunk)) {
+		*mantissa = *mantissa * 1e8 + (double)chunk;
+		*digits += *mantissa > 0 ? 8 : 0;
+		p += 8;
+	}
+	for (; p < end && c_is_digit(*p); ++p) {
+		*mantissa = *mantissa * 10 + (*p - '0');
+		*digits += *mantissa > 0;
+	}
+	return p;
+}
+
+/* converts the number at the lexer, returning 0 without moving it if it needs lex_number */
+static int fast_number(Lexer * lexer, double * number) {
+	const char * p = lexer->begin;
+	const char * end = lexer->end;
+	const char * digits_begin;
+	double mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	int negative = 0;
+	if (!FAST_NUMBERS) {
+		return 0;
+	}
+	if (p < end && *p == '-') {
+		negative = 1;
+		++p;
+	}
+	digits_begin = p;
+	p = fast_digits(p, end, &mantissa, &digits);
+	/* no digits, or leading zeros */
+	if (p == digits_begin || (*digits_begin == '0' && p - digits_begin > 1)) {
+		return 0;
+	}
+	if (p < end && *p == '.') {
+		const char * fraction = ++p;
+		p = fast_digits(p, end, &mantissa, &digits);
+		if (p == fraction) {
+			return 0;
+		}
+		exponent = -(int)(p - fraction);
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		int exponent_negative = 0;
+		int value = 0;
+		const char * exponent_begin;
+		++p;
+		if (p < end && (*p == '+' || *p == '-')) {
+			exponent_negative = *p++ == '-';
+		}
+		exponent_begin = p;
+		for (; p < end && c_is_digit(*p) && value < 1000; ++p) {
+			value = value * 10 + (*p - '0');
+		}
+		if (p == exponent_begin) {
+			return 0;
+		}
+		exponent += exponent_negative ? -value : value;
+	}
+	if (digits > FAST_MAX_DIGITS || exponent < -FAST_MAX_EXPONENT || exponent > FAST_MAX_EXPONENT
+			|| (p < end && (c_is_digit(*p) || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-'))) {
+		return 0;
+	}
+	mantissa = exponent < 0 ? mantissa / fast_powers[-exponent] : mantissa * fast_powers[exponent];
+	*number = negative ? -mantissa : mantissa;
+	lexer->begin = p;
+	return 1;
 }
 
 static Token lex_number(Ctx * ctx) {
@@ -289,6 +677,10 @@ static Token lex_number(Ctx * ctx) {
 	double value;
 	Token token;
 	char * buffer_end;
+	if (fast_number(&ctx->lexer, &token.as.number)) {
+		token.type = TT_NUMBER;
+		return token;
+	}
 	for (;;) {
 		char c = lexer_peek(&ctx->lexer);
 		if (c_is_digit(c) || c == '+' || c == '-' || c == '.' || c == 'e' || c == 'E') {
@@ -353,13 +745,14 @@ static Token lex_identifier(Ctx * ctx) {
 static Token next_token(Ctx * ctx) {
 	char c;
 loop:
+	ctx->token_begin = ctx->lexer.begin;
 	switch (c = lexer_peek(&ctx->lexer)) {
 	case ' ':
 	case '\n':
 	case '\r':
 	case '\t':
 	case '\v':
-		++ctx->lexer.begin;
+		scan_whitespace(&ctx->lexer);
 		goto loop;
 	case '{':
 		++ctx->lexer.begin;
@@ -392,483 +785,5279 @@ loop:
 	}
 }
 
-#define ALLOC(ctx, type) ctx_reallocate(ctx, NULL, 0, sizeof(type))
-#define FREE_ARRAY(ctx, ptr, size) ctx_free_array(ctx, ptr, size, sizeof(*(ptr)))
-static JSONValue * value(Token t, Ctx * ctx);
+static void scan_token(Lexer * lexer, Span * span) {
+	char c;
+	scan_whitespace(lexer);
+	span->begin = lexer->begin;
+	switch (c = lexer_peek(lexer)) {
+	case '{':
+		span->type = TT_LBRACE;
+		break;
+	case '}':
+		span->type = TT_RBRACE;
+		break;
+	case '[':
+		span->type = TT_LBRACKET;
+		break;
+	case ']':
+		span->type = TT_RBRACKET;
+		break;
+	case ',':
+		span->type = TT_COMMA;
+		break;
+	case ':':
+		span->type = TT_COLON;
+		break;
+	case '"':
+		++lexer->begin;
+		if (!scan_rest_of_string(lexer, span)) {
+			span->type = TT_ERROR;
+		}
+		return;
+	case '\0':
+		span->type = TT_EOF;
+		span->end = span->begin;
+		return;
+	default:
+		if (c_is_digit(c) || c == '-') {
+			while (!lexer_eof(lexer)) {
+				c = *lexer->begin;
+				if (!(c_is_digit(c) || c == '+' || c == '-' || c == '.' || c == 'e' || c == 'E')) {
+					break;
+				}
+				++lexer->begin;
+			}
+			span->type = TT_NUMBER;
+		} else if (starts_with("null", lexer->begin, lexer->end)) {
+			span->type = TT_NULL;
+			lexer->begin += 4;
+		} else if (starts_with("true", lexer->begin, lexer->end)) {
+			span->type = TT_TRUE;
+			lexer->begin += 4;
+		} else if (starts_with("false", lexer->begin, lexer->end)) {
+			span->type = TT_FALSE;
+			lexer->begin += 5;
+		} else {
+			span->type = TT_ERROR;
+		}
+		span->end = lexer->begin;
+		return;
+	}
+	++lexer->begin;
+	span->end = lexer->begin;
+}
 
-/* the function object() for parsing json objects
- * makes use of two helper functions to free it strings
- * and object parameters to help with the complexity of freeing them without
- * creating bugs in its definition.
- * The remove parameter accounts for
- * uninitialized slots at the end while parsing
+/*
+ * skips the rest of the value starting with span,
+ * only checking that brackets are balanced and that it ends
+ * before the input does, as its contents are never looked at
  */
+static int scan_skip_value(Lexer * lexer, const Span * span) {
+	size_t depth;
+	Span token;
+	switch (span->type) {
+	case TT_LBRACE:
+	case TT_LBRACKET:
+		break;
+	case TT_NULL:
+	case TT_TRUE:
+	case TT_FALSE:
+	case TT_NUMBER:
+	case TT_STRING:
+		return 1;
+	default:
+		return 0;
+	}
+	for (depth = 1; depth > 0;) {
+		scan_token(lexer, &token);
+		switch (token.type) {
+		case TT_LBRACE:
+		case TT_LBRACKET:
+			++depth;
+			break;
+		case TT_RBRACE:
+		case TT_RBRACKET:
+			--depth;
+			break;
+		case TT_EOF:
+		case TT_ERROR:
+			return 0;
+		default:
+			break;
+		}
+	}
+	return 1;
+}
 
-static void _object_free_strings(Ctx * ctx, char ** strings, size_t size, size_t remove) {
-	size_t i;
-	for (i = 0; i < size - remove; i++) {
-		char * str =  strings[i];
-		allocator_free(str, strlen(str) + 1, ctx->allocator);
+/* paths name the keys of nested objects, separated by '.' */
+static const char * path_segment(const char * path, size_t depth, size_t * len) {
+	const char * end;
+	for (; depth > 0; --depth) {
+		path = strchr(path, '.');
+		if (!path) {
+			return NULL;
+		}
+		++path;
 	}
-	FREE_ARRAY(ctx, strings, size);
+	end = strchr(path, '.');
+	*len = end ? (size_t)(end - path) : strlen(path);
+	return path;
 }
 
-static void _object_free_values(Ctx * ctx, JSONValue ** values, size_t size, size_t remove) {
-	size_t i;
-	for (i = 0; i < size - remove; i++) {
-		JSONValue * value = values[i];
-		json_free(value, ctx->allocator);
+static size_t path_depth(const char * path) {
+	size_t depth = 1;
+	for (; *path; ++path) {
+		depth += *path == '.';
 	}
-	FREE_ARRAY(ctx, values, size);
+	return depth;
 }
 
-static JSONObject * object(Ctx * ctx) {
-	char ** strings = NULL;
-	JSONValue ** values = NULL;
-	size_t count = 0;
-	JSONObject * obj;
+/* converts a number span with the same rules as lex_number */
+static int span_number(Ctx * ctx, const Span * span, double * number) {
+	size_t len = span->end - span->begin;
+	char * buffer_end;
+	if (len > MAX_DOUBLE_DIGITS) {
+		return 0;
+	}
+	memcpy(ctx->double_buffer, span->begin, len);
+	ctx->double_buffer[len] = '\0';
+	errno = 0;
+	*number = strtod(ctx->double_buffer, &buffer_end);
+	return !errno && (size_t)(buffer_end - ctx->double_buffer) == len;
+}
+
+/* decodes the escapes of a string span into a new allocation of size *size + 1 */
+static char * span_decode_string(Ctx * ctx, const Span * span, size_t * size) {
+	Lexer saved = ctx->lexer;
 	Token token;
-	for (token = next_token(ctx); token.type != TT_RBRACE; token = next_token(ctx)) {
-		JSONValue * nvalue;
-		JSONValue ** new_values;
-		char ** new_strings = ctx_grow_array(ctx, strings, count, count + 1, sizeof(*strings));
-		if (!new_strings) {
-			_object_free_strings(ctx, strings, count, 0);
-			return NULL;
-		}
-		new_values = ctx_grow_array(ctx, values, count, count + 1, sizeof(*values));
-		if (!new_values) {
-			_object_free_strings(ctx, new_strings, count + 1, 1);
-			_object_free_values(ctx, values, count, 0);
-			return NULL;
-		}
-		strings = new_strings;
-		values = new_values;
-		++count;
-		if (token.type != TT_STRING) {
-			_object_free_strings(ctx, strings, count, 1);
-			_object_free_values(ctx, values, count, 1);
-			return NULL;
-		}
-		strings[count - 1] = token.as.string; /* initialized last slot,
-				 _object_free_strings remove parameter should be 0 from now on
-		 */
-		token = next_token(ctx);
-		if (token.type != TT_COLON) {
-			_object_free_strings(ctx, strings, count, 0);
-			_object_free_values(ctx, values, count, 1);
-			return NULL;
-		}
-		nvalue = value(next_token(ctx), ctx);
-		if (!nvalue) {
-			_object_free_strings(ctx, strings, count, 0);
-			_object_free_values(ctx, values, count, 1);
-			return NULL;
-		}
-		values[count - 1] = nvalue;
-		token = next_token(ctx);
-		if (token.type == TT_RBRACE) {
-			break;
-		}
-		if (token.type != TT_COMMA) {
-			_object_free_strings(ctx, strings, count, 0);
-			_object_free_values(ctx, values, count, 0);
-			return NULL;
-		}
-	}
-	obj = ALLOC(ctx, JSONObject);
-	if (!obj) {
-		_object_free_strings(ctx, strings, count, 0);
-		_object_free_values(ctx, values, count, 0);
+	ctx->lexer.begin = span->begin;
+	ctx->lexer.end = span->end + 1; /* includes the closing quote */
+	token = lex_rest_of_string(ctx);
+	ctx->lexer = saved;
+	if (token.type != TT_STRING) {
 		return NULL;
 	}
-	obj->value.type = JSON_OBJ;
-	obj->strings = strings;
-	obj->values = values;
-	obj->count = count;
-	return obj;
+	*size = token.length;
+	return token.as.string;
 }
 
-static JSONArray * array(Ctx * ctx) {
-	JSONValue ** values = NULL;
-	JSONArray * array;
-	size_t size = 0;
-	Token t;
-	size_t i;
-	for (t = next_token(ctx); t.type != TT_RBRACKET; t = next_token(ctx)) {
-		JSONValue ** nvalues;
-		JSONValue * nvalue = value(t, ctx);
-		if (!nvalue) {
-			goto error;
-		}
-		nvalues = ctx_grow_array(ctx, values, size, size + 1, sizeof(*values));
-		if (!nvalues) {
-			json_free(nvalue, ctx->allocator);
-			goto error;
-		}
-		values = nvalues;
-		values[size] = nvalue;
-		++size;
-		t = next_token(ctx);
-		if (t.type == TT_RBRACKET) {
-			break;
-		}
-		if (t.type != TT_COMMA) {
-			goto error;
-		}
-	}
-	array = ALLOC(ctx, JSONArray);
-	if (!array) {
-		goto error;
+/* compares a string span to a key that is len bytes long */
+static int span_equals(Ctx * ctx, const Span * span, const char * key, size_t len) {
+	char * decoded;
+	size_t size;
+	int equal;
+	if (!span->escaped) {
+		return (size_t)(span->end - span->begin) == len && memcmp(span->begin, key, len) == 0;
 	}
-	array->value.type = JSON_ARRAY;
-	array->values = values;
-	array->size = size;
-	return array;
-error:;
-	for (i = 0; i < size; i++) {
-		json_free(values[i], ctx->allocator);
+	decoded = span_decode_string(ctx, span, &size);
+	if (!decoded) {
+		return 0;
 	}
-	FREE_ARRAY(ctx, values, size);
-	return NULL;
+	equal = size == len && memcmp(decoded, key, len) == 0;
+	allocator_free(decoded, size + 1, ctx->allocator);
+	return equal;
 }
 
-static JSONValue * value(Token t, Ctx * ctx) {
-	switch (t.type) {
-	case TT_NULL:
-		return &json_null;
-	case TT_TRUE:
-		return &json_true;
-	case TT_FALSE:
-		return &json_false;
-	case TT_STRING: {
-		JSONString * str = ALLOC(ctx, JSONString);
-		if (!str) {
-			return NULL;
-		}
-		str->value.type = JSON_STRING;
-		str->string = t.as.string;
-		return (JSONValue *)str;
-	}
-	case TT_NUMBER: {
-		JSONNumber * num = ALLOC(ctx, JSONNumber);
-		if (!num) {
-			return NULL;
+/*
+ * The reader is the scanner made public, for code that wants
+ * to walk the tokens of a document itself, like the parsers json-codegen generates.
+ */
+static const JSONTokenType token_types[] = {
+	JSON_TOKEN_NULL, /* TT_NULL */
+	JSON_TOKEN_TRUE, /* TT_TRUE */
+	JSON_TOKEN_FALSE, /* TT_FALSE */
+	JSON_TOKEN_BEGIN_OBJECT, /* TT_LBRACE */
+	JSON_TOKEN_END_OBJECT, /* TT_RBRACE */
+	JSON_TOKEN_BEGIN_ARRAY, /* TT_LBRACKET */
+	JSON_TOKEN_END_ARRAY, /* TT_RBRACKET */
+	JSON_TOKEN_COMMA, /* TT_COMMA */
+	JSON_TOKEN_COLON, /* TT_COLON */
+	JSON_TOKEN_NUMBER, /* TT_NUMBER */
+	JSON_TOKEN_STRING, /* TT_STRING */
+	JSON_TOKEN_EOF, /* TT_EOF */
+	JSON_TOKEN_ERROR /* TT_ERROR */
+};
+
+static Span span_from_token(const JSONToken * token) {
+	Span span;
+	size_t i;
+	span.type = TT_ERROR;
+	for (i = 0; i < sizeof(token_types) / sizeof(*token_types); i++) {
+		if (token_types[i] == token->type) {
+			span.type = (TokenType)i;
 		}
-		num->value.type = JSON_NUMBER;
-		num->number = t.as.number;
-		return (JSONValue *)num;
 	}
-	case TT_LBRACKET:
-		return (JSONValue *)array(ctx);
-	case TT_LBRACE:
-		return (JSONValue *)object(ctx);
-	default:
-		return NULL;
+	span.begin = token->begin;
+	span.end = token->end;
+	span.escaped = token->escaped;
+	return span;
+}
+
+JSONReader json_reader_new(const char * string, ptrdiff_t len) {
+	Lexer lexer = lexer_new(string, len);
+	JSONReader reader;
+	reader.begin = lexer.begin;
+	reader.end = lexer.end;
+	return reader;
+}
+
+JSONToken json_reader_next(JSONReader * reader) {
+	Lexer lexer;
+	Span span;
+	JSONToken token;
+	lexer.begin = reader->begin;
+	lexer.end = reader->end;
+	scan_token(&lexer, &span);
+	reader->begin = lexer.begin;
+	token.type = token_types[span.type];
+	token.begin = span.begin;
+	token.end = span.end;
+	token.escaped = span.type == TT_STRING && span.escaped;
+	return token;
+}
+
+int json_reader_skip(JSONReader * reader, const JSONToken * token) {
+	Lexer lexer;
+	Span span = span_from_token(token);
+	int ok;
+	lexer.begin = reader->begin;
+	lexer.end = reader->end;
+	ok = scan_skip_value(&lexer, &span);
+	reader->begin = lexer.begin;
+	return ok;
+}
+
+int json_token_number(const JSONToken * token, double * number) {
+	Ctx ctx;
+	Span span = span_from_token(token);
+	return span.type == TT_NUMBER && span_number(&ctx, &span, number);
+}
+
+int json_token_integer(const JSONToken * token, long * integer) {
+	char buffer[32];
+	size_t len = token->end - token->begin;
+	char * buffer_end;
+	if (token->type != JSON_TOKEN_NUMBER || len >= sizeof(buffer)) {
+		return 0;
 	}
+	memcpy(buffer, token->begin, len);
+	buffer[len] = '\0';
+	errno = 0;
+	*integer = strtol(buffer, &buffer_end, 10);
+	return !errno && (size_t)(buffer_end - buffer) == len;
 }
 
-JSONValue * json_parse(const char * string, ptrdiff_t len, JSONAllocator allocator) {
+/* hands out the caller's buffer, which is known to be big enough, to lex_rest_of_string */
+static void * buffer_allocator_callback(void * ctx, void * old_alloc, size_t old_size, size_t new_size) {
+	(void)old_alloc;
+	(void)old_size;
+	return new_size == 0 ? NULL : ctx;
+}
+
+size_t json_token_string(const JSONToken * token, char * out) {
 	Ctx ctx;
-	JSONValue * _value;
-	ctx.allocator = allocator;
-	ctx.lexer = lexer_new(string, len);
-	_value = value(next_token(&ctx), &ctx);
-	if (next_token(&ctx).type != TT_EOF) {
-		json_free(_value, allocator);
-		_value = NULL;
+	Span span = span_from_token(token);
+	size_t size;
+	if (span.type != TT_STRING) {
+		return (size_t)-1;
 	}
-	return _value;
+	if (!span.escaped) {
+		size = span.end - span.begin;
+		memcpy(out, span.begin, size);
+		out[size] = '\0';
+		return size;
+	}
+	ctx.allocator = json_allocator_new(out, buffer_allocator_callback);
+	ctx.lexer = lexer_new(span.begin, 0);
+	return span_decode_string(&ctx, &span, &size) ? size : (size_t)-1;
 }
 
+/* maps base64 characters to their 6 bit values, and everything else to 64 */
+static const unsigned char base64_values[256] = {
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 62, 64, 64, 64, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 64, 64, 64, 64, 64, 64,
+	64,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 64, 64, 64, 64, 64,
+	64, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64
+};
 
-JSONAllocator json_allocator_new(void * ctx, JSONAllocatorCallback callback) {
-	JSONAllocator allocator;
-	allocator.ctx = ctx;
-	allocator.callback = callback;
-	return allocator;
+static const char base64_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* returns (size_t)-1 if len can't be the length of base64 text */
+static size_t base64_decoded_size(const char * text, size_t len) {
+	if (len % 4 == 1) {
+		return (size_t)-1;
+	}
+	if (len % 4 == 0 && len > 0) {
+		len -= text[len - 1] == '=';
+		len -= text[len - 1] == '=';
+	}
+	return len / 4 * 3 + (len % 4 == 0 ? 0 : len % 4 - 1);
 }
 
-static void * default_allocator_callback(void * ctx, void * old_alloc, size_t old_size, size_t new_size) {
-	(void)ctx;
-	(void)old_size;
-	return realloc(old_alloc, new_size);
+/* checks that every character of base64 text before its padding is a base64 digit */
+static int base64_valid(const char * text, size_t len) {
+	const unsigned char * in = (const unsigned char *)text;
+	unsigned char bits = 0;
+	size_t i;
+	if (len % 4 == 0 && len > 0) {
+		len -= text[len - 1] == '=';
+		len -= text[len - 1] == '=';
+	}
+	for (i = 0; i < len; i++) {
+		bits |= base64_values[in[i]];
+	}
+	return !(bits & 64);
 }
 
-JSONAllocator json_default_allocator(void) {
-	JSONAllocator allocator;
-	allocator.callback = default_allocator_callback;
-	/* allocator.ctx does not need to be initialized as the system allocator uses global state */
-	return allocator;
+#ifdef JSON_USE_SSE2
+/* the bytes of block between lo and hi, compared as signed so that bytes above 0x7F never match */
+static __m128i sse2_bytes_between(__m128i block, char lo, char hi) {
+	return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8((char)(lo - 1))), _mm_cmplt_epi8(block, _mm_set1_epi8((char)(hi + 1))));
 }
 
-static void free_object(JSONObject * obj, JSONAllocator allocator) {
-	size_t i;
-	for (i = 0; i < obj->count; i++) {
-		char * string = obj->strings[i];
-		JSONValue * value = obj->values[i];
-		allocator_free(string, strlen(string) + 1, allocator);
-		json_free(value, allocator);
+/*
+ * Decodes 16 characters into 12 bytes. Each character's class gives the offset to its value,
+ * then pairs of 6 bit values are joined by shifts and pairs of 12 bit values by a multiply-add.
+ */
+static int base64_decode_block(const unsigned char * in, unsigned char * out) {
+	__m128i block = _mm_loadu_si128((const __m128i *)in);
+	__m128i upper = sse2_bytes_between(block, 'A', 'Z');
+	__m128i lower = sse2_bytes_between(block, 'a', 'z');
+	__m128i digit = sse2_bytes_between(block, '0', '9');
+	__m128i plus = _mm_cmpeq_epi8(block, _mm_set1_epi8('+'));
+	__m128i slash = _mm_cmpeq_epi8(block, _mm_set1_epi8('/'));
+	__m128i offsets;
+	__m128i pairs;
+	unsigned char words[16];
+	int i;
+	if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash))) != 0xFFFF) {
+		return 0;
+	}
+	offsets = _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')), _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+		_mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+			_mm_or_si128(_mm_and_si128(plus, _mm_set1_epi8(62 - '+')), _mm_and_si128(slash, _mm_set1_epi8(63 - '/')))));
+	block = _mm_add_epi8(block, offsets);
+	pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(block, _mm_set1_epi16(0xFF)), 6), _mm_srli_epi16(block, 8));
+	_mm_storeu_si128((__m128i *)words, _mm_madd_epi16(pairs, _mm_set_epi16(1, 4096, 1, 4096, 1, 4096, 1, 4096)));
+	/* each little endian word holds 24 bits, which are written most significant first */
+	for (i = 0; i < 4; i++) {
+		out[3 * i] = words[4 * i + 2];
+		out[3 * i + 1] = words[4 * i + 1];
+		out[3 * i + 2] = words[4 * i];
 	}
-	allocator_free_array(obj->strings, obj->count, sizeof(*obj->strings), allocator);
-	allocator_free_array(obj->values, obj->count, sizeof(*obj->values), allocator);
-	allocator_free(obj, sizeof(JSONObject), allocator);
+	return 1;
 }
+#endif
 
-void json_free(JSONValue * value, JSONAllocator allocator) {
-	JSONArray * array;
-	JSONString * string;
-	size_t i;
-	switch (value->type) {
-	case JSON_OBJ:
-		free_object((JSONObject *)value, allocator);
-		break;
-	case JSON_ARRAY:
-		array = (JSONArray *)value;
-		for (i = 0; i < array->size; i++) {
-			json_free(array->values[i], allocator);
+/*
+ * decodes base64 text, where the padding is optional, into out
+ * which must hold base64_decoded_size(text, len) bytes.
+ * Whole groups of 4 characters are validated at once
+ * by or-ing their values together, keeping the loop free of per character branches.
+ * With SSE2, 4 groups at a time are decoded in a block.
+ */
+static int base64_decode(const char * text, size_t len, unsigned char * out) {
+	const unsigned char * in = (const unsigned char *)text;
+	size_t size = base64_decoded_size(text, len);
+	size_t groups = size / 3;
+	size_t rest = size % 3;
+	size_t i = 0;
+	if (size == (size_t)-1) {
+		return 0;
+	}
+#ifdef JSON_USE_SSE2
+	for (; groups - i >= 4; i += 4) {
+		if (!base64_decode_block(in, out)) {
+			return 0;
+		}
+		in += 16;
+		out += 12;
+	}
+#endif
+	for (; i < groups; i++) {
+		unsigned long a = base64_values[in[0]];
+		unsigned long b = base64_values[in[1]];
+		unsigned long c = base64_values[in[2]];
+		unsigned long d = base64_values[in[3]];
+		unsigned long bits = a << 18 | b << 12 | c << 6 | d;
+		if ((a | b | c | d) & 64) {
+			return 0;
+		}
+		out[0] = (bits >> 16) & 0xFF;
+		out[1] = (bits >> 8) & 0xFF;
+		out[2] = bits & 0xFF;
+		in += 4;
+		out += 3;
+	}
+	if (rest > 0) {
+		unsigned long a = base64_values[in[0]];
+		unsigned long b = base64_values[in[1]];
+		unsigned long c = rest == 2 ? base64_values[in[2]] : 0;
+		unsigned long bits = a << 18 | b << 12 | c << 6;
+		if ((a | b | c) & 64) {
+			return 0;
+		}
+		out[0] = (bits >> 16) & 0xFF;
+		if (rest == 2) {
+			out[1] = (bits >> 8) & 0xFF;
 		}
-		allocator_free_array(array->values, array->size, sizeof(*array->values), allocator);
-		allocator_free(array, sizeof(JSONArray), allocator);
-		break;
-	case JSON_STRING:
-		string = (JSONString *)value;
-		allocator_free(string->string, strlen(string->string) + 1, allocator);
-		allocator_free(string, sizeof(JSONString), allocator);
-		break;
-	case JSON_NUMBER:
-		allocator_free(value, sizeof(JSONNumber), allocator);
-		break;
-	case JSON_BOOL:
-	case JSON_NULL:
-		break;
 	}
+	return 1;
 }
 
+#define ALLOC(ctx, type) ctx_reallocate(ctx, NULL, 0, sizeof(type))
 
-JSONType json_value_type(const JSONValue * value) {
-	return value->type;
+/*
+ * Parsing with retain_spans allocates every node with a SourceSpan after it,
+ * locating the text it was parsed from. The printers copy that text instead of
+ * formatting the node again, until the node is marked dirty by an edit.
+ */
+#define VALUE_HAS_SPAN 1
+#define VALUE_DIRTY 2
+
+typedef struct {
+	const char * begin;
+	size_t length;
+} SourceSpan;
+
+static size_t value_base_size(const JSONValue * value) {
+	switch (value->type) {
+	case JSON_NUMBER:
+		return sizeof(JSONNumber);
+	case JSON_STRING:
+		return sizeof(JSONString);
+	case JSON_BINARY:
+		return sizeof(JSONBinary);
+	case JSON_RAW:
+		return sizeof(JSONRaw);
+	case JSON_ARRAY:
+		return sizeof(JSONArray);
+	case JSON_OBJ:
+		return sizeof(JSONObject);
+	default:
+		return sizeof(JSONValue);
+	}
 }
 
-int json_value_as_bool(const JSONValue * value) {
-	return value == &json_true;
+/* the size a node was allocated with */
+static size_t value_size(const JSONValue * value) {
+	return value_base_size(value) + (value->flags & VALUE_HAS_SPAN ? sizeof(SourceSpan) : 0);
 }
 
-double json_value_as_number(const JSONValue * value) {
-	return ((JSONNumber *)value)->number;
+static SourceSpan * value_span(const JSONValue * value) {
+	return (SourceSpan *)((char *)value + value_base_size(value));
 }
 
-const char * json_value_as_string(const JSONValue * value) {
-	return ((JSONString *)value)->string;
+/* whether the value can be printed by copying its source text */
+static int value_is_clean(const JSONValue * value) {
+	return (value->flags & (VALUE_HAS_SPAN | VALUE_DIRTY)) == VALUE_HAS_SPAN;
 }
 
-const JSONArray * json_value_as_array(const JSONValue * value) {
-	return (JSONArray *)value;
+static size_t ctx_node_size(const Ctx * ctx, size_t size) {
+	return ctx->options->retain_spans ? size + sizeof(SourceSpan) : size;
 }
 
-const JSONObject * json_value_as_object(const JSONValue * value) {
-	return (JSONObject *)value;
+static void * ctx_alloc_node(Ctx * ctx, size_t size) {
+	JSONValue * node = ctx_reallocate(ctx, NULL, 0, ctx_node_size(ctx, size));
+	if (node) {
+		node->flags = ctx->options->retain_spans ? VALUE_HAS_SPAN : 0;
+	}
+	return node;
 }
 
-const JSONValue * json_array_as_value(const JSONArray * array) {
-	return (JSONValue *)array;
+static void ctx_set_span(JSONValue * value, const char * begin, const char * end) {
+	if (value->flags & VALUE_HAS_SPAN) {
+		SourceSpan * span = value_span(value);
+		span->begin = begin;
+		span->length = end - begin;
+	}
 }
 
-const JSONValue * json_object_as_value(const JSONObject * obj) {
-	return (JSONValue *)obj;
+#define ALLOC_NODE(ctx, type) ctx_alloc_node(ctx, sizeof(type))
+#define FREE_ARRAY(ctx, ptr, size) ctx_free_array(ctx, ptr, size, sizeof(*(ptr)))
+static JSONValue * value(Token t, Ctx * ctx);
+static void deduper_init(Deduper * deduper, JSONAllocator allocator);
+static void deduper_forget(Deduper * deduper);
+static void deduper_deinit(Deduper * deduper);
+static JSONValue * deduper_intern(Deduper * deduper, JSONValue * value);
+
+/* the function object() for parsing json objects
+ * makes use of two helper functions to free it strings
+ * and object parameters to help with the complexity of freeing them without
+ * creating bugs in its definition.
+ * The count parameter is the number of initialized slots,
+ * and capacity the size of the array, which may have room to spare while parsing
+ */
+
+static void _object_free_strings(Ctx * ctx, char ** strings, size_t count, size_t capacity) {
+	size_t i;
+	if (ctx->allocator.flags & JSON_ALLOCATOR_FREE_NOOP) {
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		char * str =  strings[i];
+		allocator_free(str, strlen(str) + 1, ctx->allocator);
+	}
+	FREE_ARRAY(ctx, strings, capacity);
 }
 
-const JSONValue * json_array_index(const JSONArray * array, size_t index) {
-	return array->values[index];
+static void _object_free_values(Ctx * ctx, JSONValue ** values, size_t count, size_t capacity) {
+	size_t i;
+	if (ctx->allocator.flags & JSON_ALLOCATOR_FREE_NOOP) {
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		JSONValue * value = values[i];
+		json_free(value, ctx->allocator);
+	}
+	FREE_ARRAY(ctx, values, capacity);
 }
 
-const JSONValue * json_object_index(const JSONObject * obj, size_t index) {
-	return obj->values[index];
+/*
+ * Containers are first allocated with room for as many values as containers
+ * at the same depth usually had, which a Ctx learns from everything it parses.
+ * They grow geometrically from there, and are shrunk to fit at the end,
+ * so that they can be freed knowing only their size.
+ * Documents of a steady shape are then parsed with one allocation per array.
+ */
+static size_t * ctx_size_hint(size_t * hints, size_t depth) {
+	return &hints[depth < CTX_HINT_DEPTHS ? depth : CTX_HINT_DEPTHS - 1];
 }
 
-const char * json_object_index_keys(const JSONObject * obj, size_t index) {
-	return obj->strings[index];
+/* moves the hint a quarter of the way to size, rounding up so that it settles on steady sizes */
+static void update_size_hint(size_t * hint, size_t size) {
+	if (*hint == 0) {
+		*hint = size;
+		return;
+	}
+	*hint = (*hint * 3 + size + 3) / 4;
 }
 
-const JSONValue * json_object_get(const JSONObject * obj, const char * key) {
-	size_t i;
-	for (i = 0; i < obj->count; i++) {
-		if (strcmp(key, obj->strings[i]) == 0) {
-			return obj->values[i];
-		}
+static size_t next_capacity(size_t capacity, size_t hint) {
+	if (capacity == 0) {
+		return hint > 0 ? hint : 4;
 	}
-	return NULL;
+	return capacity * 2;
 }
 
-size_t json_array_length(const JSONArray * array) {
-	return array->size;
+/* returns the array shrunk to size, or NULL on failure, or when it was freed for being empty */
+static void * ctx_fit_array(Ctx * ctx, void * old_alloc, size_t capacity, size_t size, size_t element_size) {
+	if (size == 0) {
+		ctx_free_array(ctx, old_alloc, capacity, element_size);
+		return NULL;
+	}
+	if (size == capacity) {
+		return old_alloc;
+	}
+	return ctx_reallocate(ctx, old_alloc, capacity * element_size, size * element_size);
 }
 
-size_t json_object_count(const JSONObject * obj) {
-	return obj->count;
+static unsigned long hash_keys(char ** keys, size_t count) {
+	unsigned long hash = 2166136261UL;
+	size_t i;
+	for (i = 0; i < count; i++) {
+		const unsigned char * c = (const unsigned char *)keys[i];
+		/* the terminator is hashed too so that ["ab"] and ["a", "b"] differ */
+		do {
+			hash = ((hash ^ *c) * 16777619UL) & 0xFFFFFFFFUL;
+		} while (*c++ != '\0');
+	}
+	return hash;
 }
 
-static void print_indent(FILE * file, size_t indent) {
+static int shape_matches(const JSONShape * shape, char ** keys, size_t count, unsigned long hash) {
 	size_t i;
-	for (i = 0; i < indent; i++) {
-		fputs("  ", file);
+	if (shape->hash != hash || shape->count != count) {
+		return 0;
+	}
+	for (i = 0; i < count; i++) {
+		if (strcmp(shape->keys[i], keys[i]) != 0) {
+			return 0;
+		}
 	}
+	return 1;
 }
 
-static void print_value(FILE * file, const JSONValue * value, size_t indent);
+static void shape_release(JSONShape * shape) {
+	JSONAllocator allocator = shape->allocator;
+	size_t i;
+	if (ATOMIC_DECREMENT(shape->refs) > 0) {
+		return;
+	}
+	for (i = 0; i < shape->count; i++) {
+		char * key = shape->keys[i];
+		allocator_free(key, strlen(key) + 1, allocator);
+	}
+	allocator_free_array(shape->keys, shape->count, sizeof(*shape->keys), allocator);
+	allocator_free(shape, sizeof(JSONShape), allocator);
+}
+
+/* the table is only a cache, so failing to grow it just means
+ * that later objects with this key sequence won't be shared
+ */
+static void ctx_remember_shape(Ctx * ctx, JSONShape * shape) {
+	size_t i;
+	size_t mask;
+	if ((ctx->shape_count + 1) * 2 > ctx->shape_capacity) {
+		size_t new_capacity = ctx->shape_capacity ? ctx->shape_capacity * 2 : 16;
+		JSONShape ** new_shapes = ctx_grow_array(ctx, NULL, 0, new_capacity, sizeof(*new_shapes));
+		if (!new_shapes) {
+			return;
+		}
+		for (i = 0; i < new_capacity; i++) {
+			new_shapes[i] = NULL;
+		}
+		for (i = 0; i < ctx->shape_capacity; i++) {
+			JSONShape * old = ctx->shapes[i];
+			size_t j;
+			if (!old) {
+				continue;
+			}
+			for (j = old->hash & (new_capacity - 1); new_shapes[j]; j = (j + 1) & (new_capacity - 1));
+			new_shapes[j] = old;
+		}
+		FREE_ARRAY(ctx, ctx->shapes, ctx->shape_capacity);
+		ctx->shapes = new_shapes;
+		ctx->shape_capacity = new_capacity;
+	}
+	mask = ctx->shape_capacity - 1;
+	for (i = shape->hash & mask; ctx->shapes[i]; i = (i + 1) & mask);
+	ctx->shapes[i] = shape;
+	++ctx->shape_count;
+}
+
+/* takes ownership of keys, either handing them to a new shape
+ * or freeing them in favour of an identical shape seen earlier
+ */
+static JSONShape * ctx_intern_shape(Ctx * ctx, char ** keys, size_t count) {
+	unsigned long hash = hash_keys(keys, count);
+	JSONShape * shape;
+	if (ctx->shape_capacity > 0) {
+		size_t mask = ctx->shape_capacity - 1;
+		size_t i;
+		for (i = hash & mask; (shape = ctx->shapes[i]); i = (i + 1) & mask) {
+			if (shape_matches(shape, keys, count, hash)) {
+				_object_free_strings(ctx, keys, count, count);
+				++shape->refs;
+				return shape;
+			}
+		}
+	}
+	shape = ALLOC(ctx, JSONShape);
+	if (!shape) {
+		return NULL;
+	}
+	shape->keys = keys;
+	shape->count = count;
+	shape->refs = 1;
+	shape->hash = hash;
+	shape->hint = 0;
+	shape->allocator = ctx->allocator;
+	ctx_remember_shape(ctx, shape);
+	return shape;
+}
+
+static int ctx_is_base64_key(const Ctx * ctx, const char * key) {
+	size_t i;
+	for (i = 0; i < ctx->options->base64_field_count; i++) {
+		if (strcmp(ctx->options->base64_fields[i], key) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static JSONBinary * ctx_new_binary(Ctx * ctx, const char * text, size_t len) {
+	size_t size = base64_decoded_size(text, len);
+	JSONBinary * binary;
+	unsigned char * bytes = NULL;
+	if (size == (size_t)-1) {
+		return NULL;
+	}
+	if (size > 0) {
+		bytes = ctx_reallocate(ctx, NULL, 0, size);
+		if (!bytes) {
+			return NULL;
+		}
+	}
+	if (!base64_decode(text, len, bytes) || !(binary = ALLOC_NODE(ctx, JSONBinary))) {
+		allocator_free(bytes, size, ctx->allocator);
+		return NULL;
+	}
+	binary->value.type = JSON_BINARY;
+	binary->value.refs = 1;
+	binary->bytes = bytes;
+	binary->length = size;
+	return binary;
+}
+
+/* decodes a string marked as base64 straight from the input, without copying the text first */
+static JSONValue * base64_value(Ctx * ctx) {
+	JSONBinary * binary;
+	Span span;
+	char * decoded;
+	size_t size;
+	const char * begin;
+	scan_whitespace(&ctx->lexer);
+	if (lexer_peek(&ctx->lexer) != '"') {
+		return value(next_token(ctx), ctx);
+	}
+	begin = ctx->lexer.begin++;
+	if (!scan_rest_of_string(&ctx->lexer, &span)) {
+		return NULL;
+	}
+	if (!span.escaped) {
+		binary = ctx_new_binary(ctx, span.begin, span.end - span.begin);
+		if (binary) {
+			ctx_set_span((JSONValue *)binary, begin, ctx->lexer.begin);
+		}
+		return (JSONValue *)binary;
+	}
+	/* encoders may escape '/' */
+	decoded = span_decode_string(ctx, &span, &size);
+	if (!decoded) {
+		return NULL;
+	}
+	binary = ctx_new_binary(ctx, decoded, size);
+	allocator_free(decoded, size + 1, ctx->allocator);
+	if (binary) {
+		ctx_set_span((JSONValue *)binary, begin, ctx->lexer.begin);
+	}
+	return (JSONValue *)binary;
+}
+
+/* returns the raw paths among live whose segment at level is key, setting *whole when one of them ends there */
+static unsigned long ctx_match_raw_paths(Ctx * ctx, unsigned long live, size_t level, const char * key, size_t key_length, int * whole) {
+	unsigned long matched = 0;
+	size_t i;
+	for (i = 0; i < ctx->options->raw_path_count && i < JSON_MAX_RAW_PATHS; i++) {
+		const char * segment;
+		size_t len;
+		if (!(live & (1UL << i))) {
+			continue;
+		}
+		segment = path_segment(ctx->options->raw_paths[i], level, &len);
+		if (!segment || len != key_length || memcmp(segment, key, len) != 0) {
+			continue;
+		}
+		matched |= 1UL << i;
+		if (segment[len] == '\0') {
+			*whole = 1;
+		}
+	}
+	return matched;
+}
+
+/*
+ * checks the grammar of the rest of the value starting with span, with the same
+ * rules as the parser, but without building any nodes or decoding any strings
+ */
+static int scan_check_value(Ctx * ctx, const Span * span) {
+	Span token;
+	double number;
+	int object;
+	switch (span->type) {
+	case TT_NULL:
+	case TT_TRUE:
+	case TT_FALSE:
+		return 1;
+	case TT_NUMBER:
+		return span_number(ctx, span, &number);
+	case TT_STRING:
+		return !span->escaped || escapes_valid(span->begin, span->end);
+	case TT_LBRACE:
+	case TT_LBRACKET:
+		break;
+	default:
+		return 0;
+	}
+	object = span->type == TT_LBRACE;
+	scan_token(&ctx->lexer, &token);
+	if (token.type == (object ? TT_RBRACE : TT_RBRACKET)) {
+		return 1;
+	}
+	for (;;) {
+		if (object) {
+			if (token.type != TT_STRING || !scan_check_value(ctx, &token)) {
+				return 0;
+			}
+			scan_token(&ctx->lexer, &token);
+			if (token.type != TT_COLON) {
+				return 0;
+			}
+			scan_token(&ctx->lexer, &token);
+		}
+		if (!scan_check_value(ctx, &token)) {
+			return 0;
+		}
+		scan_token(&ctx->lexer, &token);
+		if (token.type == (object ? TT_RBRACE : TT_RBRACKET)) {
+			return 1;
+		}
+		if (token.type != TT_COMMA) {
+			return 0;
+		}
+		scan_token(&ctx->lexer, &token);
+	}
+}
+
+/* keeps the text of a value at a raw path, which is checked but not parsed */
+static JSONValue * raw_value(Ctx * ctx) {
+	const char * begin;
+	Span span;
+	scan_whitespace(&ctx->lexer);
+	begin = ctx->lexer.begin;
+	scan_token(&ctx->lexer, &span);
+	if (!scan_check_value(ctx, &span)) {
+		return NULL;
+	}
+	return json_new_raw(begin, ctx->lexer.begin - begin, ctx->allocator);
+}
+
+/* frees the string of a token that is rejected instead of being taken over by a value */
+static void ctx_drop_token(Ctx * ctx, Token token) {
+	if (token.type == TT_STRING) {
+		allocator_free(token.as.string, token.length + 1, ctx->allocator);
+	}
+}
+
+/* the members of an array or object being parsed, of which arrays have no keys */
+typedef struct {
+	char ** keys;
+	JSONValue ** values;
+	size_t count;
+	size_t keys_capacity;
+	size_t values_capacity;
+	size_t * hint;
+} Members;
+
+static void members_init(Members * members, size_t * hint) {
+	members->keys = NULL;
+	members->values = NULL;
+	members->count = 0;
+	members->keys_capacity = 0;
+	members->values_capacity = 0;
+	members->hint = hint;
+}
+
+static void members_free(Ctx * ctx, Members * members) {
+	_object_free_strings(ctx, members->keys, members->keys ? members->count : 0, members->keys_capacity);
+	_object_free_values(ctx, members->values, members->count, members->values_capacity);
+}
+
+/* appends a value, and its key for objects; on failure both are freed */
+static int members_push(Ctx * ctx, Members * members, char * key, size_t key_length, JSONValue * nvalue) {
+	if (key && members->count == members->keys_capacity) {
+		size_t new_capacity = next_capacity(members->keys_capacity, *members->hint);
+		char ** new_keys = ctx_grow_array(ctx, members->keys, members->keys_capacity, new_capacity, sizeof(*new_keys));
+		if (!new_keys) {
+			goto error;
+		}
+		members->keys = new_keys;
+		members->keys_capacity = new_capacity;
+	}
+	if (members->count == members->values_capacity) {
+		size_t new_capacity = next_capacity(members->values_capacity, *members->hint);
+		JSONValue ** new_values = ctx_grow_array(ctx, members->values, members->values_capacity, new_capacity, sizeof(*new_values));
+		if (!new_values) {
+			goto error;
+		}
+		members->values = new_values;
+		members->values_capacity = new_capacity;
+	}
+	if (key) {
+		members->keys[members->count] = key;
+	}
+	members->values[members->count++] = nvalue;
+	return 1;
+error:
+	if (key) {
+		allocator_free(key, key_length + 1, ctx->allocator);
+	}
+	json_free(nvalue, ctx->allocator);
+	return 0;
+}
+
+/* shrinks the buffers to fit, learning the size for the next container at this depth */
+static int members_fit(Ctx * ctx, Members * members) {
+	size_t count = members->count;
+	update_size_hint(members->hint, count);
+	if (members->keys || members->keys_capacity > 0) {
+		char ** fitted_keys = ctx_fit_array(ctx, members->keys, members->keys_capacity, count, sizeof(*fitted_keys));
+		if (!fitted_keys && count > 0) {
+			return 0;
+		}
+		members->keys = fitted_keys;
+		members->keys_capacity = count;
+	}
+	{
+		JSONValue ** fitted_values = ctx_fit_array(ctx, members->values, members->values_capacity, count, sizeof(*fitted_values));
+		if (!fitted_values && count > 0) {
+			return 0;
+		}
+		members->values = fitted_values;
+		members->values_capacity = count;
+	}
+	return 1;
+}
+
+/* the following build the container, or free the members on failure */
+
+static JSONArray * members_finish_array(Ctx * ctx, Members * members) {
+	JSONArray * array;
+	if (!members_fit(ctx, members) || !(array = ALLOC_NODE(ctx, JSONArray))) {
+		members_free(ctx, members);
+		return NULL;
+	}
+	array->value.type = JSON_ARRAY;
+	array->value.refs = 1;
+	array->values = members->values;
+	array->size = members->count;
+	return array;
+}
+
+static JSONObject * members_finish_object(Ctx * ctx, Members * members) {
+	JSONObject * obj;
+	JSONShape * shape;
+	if (!members_fit(ctx, members) || !(obj = ALLOC_NODE(ctx, JSONObject))) {
+		members_free(ctx, members);
+		return NULL;
+	}
+	shape = ctx_intern_shape(ctx, members->keys, members->count);
+	if (!shape) {
+		allocator_free(obj, ctx_node_size(ctx, sizeof(JSONObject)), ctx->allocator);
+		members_free(ctx, members);
+		return NULL;
+	}
+	obj->value.type = JSON_OBJ;
+	obj->value.refs = 1;
+	obj->shape = shape;
+	obj->values = members->values;
+	obj->count = members->count;
+	return obj;
+}
+
+/* parses the value of a member whose key is known, with the raw paths continuing below it in *live */
+static JSONValue * member_value(Ctx * ctx, unsigned long * live, size_t level, const char * key, size_t key_length, int * parse_later) {
+	int raw_whole = 0;
+	*parse_later = 0;
+	*live = *live ? ctx_match_raw_paths(ctx, *live, level, key, key_length, &raw_whole) : 0;
+	if (raw_whole) {
+		return raw_value(ctx);
+	}
+	if (ctx_is_base64_key(ctx, key)) {
+		JSONValue * nvalue = base64_value(ctx);
+		if (nvalue && ctx->options->dedup) {
+			nvalue = deduper_intern(&ctx->deduper, nvalue);
+		}
+		return nvalue;
+	}
+	*parse_later = 1;
+	return NULL;
+}
+
+static JSONObject * object(Ctx * ctx) {
+	Members members;
+	unsigned long live = ctx->raw_live;
+	size_t level = ctx->raw_level;
+	Token token;
+	members_init(&members, ctx_size_hint(ctx->object_hints, ctx->depth));
+	for (token = next_token(ctx); token.type != TT_RBRACE; token = next_token(ctx)) {
+		char * key;
+		size_t key_length;
+		JSONValue * nvalue;
+		unsigned long matched = live;
+		int parse_later;
+		if (token.type != TT_STRING) {
+			goto error;
+		}
+		key = token.as.string;
+		key_length = token.length;
+		token = next_token(ctx);
+		if (token.type != TT_COLON) {
+			ctx_drop_token(ctx, token);
+			allocator_free(key, key_length + 1, ctx->allocator);
+			goto error;
+		}
+		nvalue = member_value(ctx, &matched, level, key, key_length, &parse_later);
+		if (parse_later) {
+			ctx->raw_live = matched;
+			ctx->raw_level = level + 1;
+			nvalue = value(next_token(ctx), ctx);
+		}
+		if (!nvalue) {
+			allocator_free(key, key_length + 1, ctx->allocator);
+			goto error;
+		}
+		if (!members_push(ctx, &members, key, key_length, nvalue)) {
+			goto error;
+		}
+		token = next_token(ctx);
+		if (token.type == TT_RBRACE) {
+			break;
+		}
+		if (token.type != TT_COMMA) {
+			ctx_drop_token(ctx, token);
+			goto error;
+		}
+	}
+	ctx->raw_live = live;
+	ctx->raw_level = level;
+	return members_finish_object(ctx, &members);
+error:
+	members_free(ctx, &members);
+	return NULL;
+}
+
+/*
+ * Arrays starting with a number are parsed by a loop of their own while their elements
+ * are numbers, which converts them straight from the input without going through tokens.
+ */
+#define RUN_ERROR 0
+#define RUN_CLOSED 1 /* the array ended */
+#define RUN_MIXED 2 /* an element that isn't a number is next */
+
+static JSONValue * run_number(Ctx * ctx, const char * begin, double number) {
+	JSONNumber * num = ALLOC_NODE(ctx, JSONNumber);
+	if (!num) {
+		return NULL;
+	}
+	num->value.type = JSON_NUMBER;
+	num->value.refs = 1;
+	num->number = number;
+	ctx_set_span(&num->value, begin, ctx->lexer.begin);
+	if (!ctx->options->dedup) {
+		return &num->value;
+	}
+	return deduper_intern(&ctx->deduper, &num->value);
+}
+
+static int number_run(Ctx * ctx, Members * members) {
+	Lexer * lexer = &ctx->lexer;
+	for (;;) {
+		JSONValue * nvalue;
+		const char * begin;
+		double number;
+		char c;
+		scan_whitespace(lexer);
+		c = lexer_peek(lexer);
+		if (c != ',') {
+			lexer->begin += c == ']';
+			return c == ']' ? RUN_CLOSED : RUN_ERROR;
+		}
+		++lexer->begin;
+		scan_whitespace(lexer);
+		c = lexer_peek(lexer);
+		if (c == ']') {
+			++lexer->begin;
+			return RUN_CLOSED;
+		}
+		if (!c_is_digit(c) && c != '-') {
+			return RUN_MIXED;
+		}
+		begin = lexer->begin;
+		if (!fast_number(lexer, &number)) {
+			Token token = lex_number(ctx);
+			if (token.type != TT_NUMBER) {
+				return RUN_ERROR;
+			}
+			number = token.as.number;
+		}
+		nvalue = run_number(ctx, begin, number);
+		if (!nvalue || !members_push(ctx, members, NULL, 0, nvalue)) {
+			return RUN_ERROR;
+		}
+	}
+}
+
+static JSONArray * array(Ctx * ctx) {
+	Members members;
+	Token t;
+	members_init(&members, ctx_size_hint(ctx->array_hints, ctx->depth));
+	t = next_token(ctx);
+	if (t.type == TT_NUMBER) {
+		JSONValue * nvalue = value(t, ctx);
+		if (!nvalue || !members_push(ctx, &members, NULL, 0, nvalue)) {
+			goto error;
+		}
+		switch (number_run(ctx, &members)) {
+		case RUN_CLOSED:
+			return members_finish_array(ctx, &members);
+		case RUN_MIXED:
+			t = next_token(ctx);
+			break;
+		default:
+			goto error;
+		}
+	}
+	for (; t.type != TT_RBRACKET; t = next_token(ctx)) {
+		JSONValue * nvalue = value(t, ctx);
+		if (!nvalue || !members_push(ctx, &members, NULL, 0, nvalue)) {
+			goto error;
+		}
+		t = next_token(ctx);
+		if (t.type == TT_RBRACKET) {
+			break;
+		}
+		if (t.type != TT_COMMA) {
+			ctx_drop_token(ctx, t);
+			goto error;
+		}
+	}
+	return members_finish_array(ctx, &members);
+error:
+	members_free(ctx, &members);
+	return NULL;
+}
+
+static JSONValue * parse_value(Token t, Ctx * ctx) {
+	switch (t.type) {
+	case TT_NULL:
+		return &json_null;
+	case TT_TRUE:
+		return &json_true;
+	case TT_FALSE:
+		return &json_false;
+	case TT_STRING: {
+		JSONString * str = ALLOC_NODE(ctx, JSONString);
+		if (!str) {
+			return NULL;
+		}
+		str->value.type = JSON_STRING;
+		str->value.refs = 1;
+		str->string = t.as.string;
+		str->length = t.length;
+		return (JSONValue *)str;
+	}
+	case TT_NUMBER: {
+		JSONNumber * num = ALLOC_NODE(ctx, JSONNumber);
+		if (!num) {
+			return NULL;
+		}
+		num->value.type = JSON_NUMBER;
+		num->value.refs = 1;
+		num->number = t.as.number;
+		return (JSONValue *)num;
+	}
+	case TT_LBRACKET: {
+		JSONValue * container;
+		unsigned long live = ctx->raw_live;
+		/* paths only go through objects */
+		ctx->raw_live = 0;
+		++ctx->depth;
+		container = (JSONValue *)array(ctx);
+		--ctx->depth;
+		ctx->raw_live = live;
+		return container;
+	}
+	case TT_LBRACE: {
+		JSONValue * container;
+		++ctx->depth;
+		container = (JSONValue *)object(ctx);
+		--ctx->depth;
+		return container;
+	}
+	default:
+		return NULL;
+	}
+}
+
+/* parses a value, recording its span, and replacing it with an identical one parsed before when deduplicating */
+static JSONValue * value(Token t, Ctx * ctx) {
+	const char * begin = ctx->token_begin;
+	JSONValue * parsed = parse_value(t, ctx);
+	if (!parsed) {
+		return NULL;
+	}
+	ctx_set_span(parsed, begin, ctx->lexer.begin);
+	if (!ctx->options->dedup) {
+		return parsed;
+	}
+	return deduper_intern(&ctx->deduper, parsed);
+}
+
+JSONParseOptions json_default_parse_options(void) {
+	JSONParseOptions options;
+	options.base64_fields = NULL;
+	options.base64_field_count = 0;
+	options.dedup = 0;
+	options.raw_paths = NULL;
+	options.raw_path_count = 0;
+	options.retain_spans = 0;
+	return options;
+}
+
+JSONValue * json_parse(const char * string, ptrdiff_t len, JSONAllocator allocator) {
+	JSONParseOptions options = json_default_parse_options();
+	return json_parse_with_options(string, len, allocator, &options);
+}
+
+static void ctx_init(Ctx * ctx, JSONAllocator allocator, const JSONParseOptions * options) {
+	size_t i;
+	ctx->allocator = allocator;
+	ctx->options = options;
+	ctx->shapes = NULL;
+	ctx->shape_capacity = 0;
+	ctx->shape_count = 0;
+	deduper_init(&ctx->deduper, allocator);
+	ctx->raw_live = 0;
+	ctx->raw_level = 0;
+	ctx->depth = 0;
+	for (i = 0; i < CTX_HINT_DEPTHS; i++) {
+		ctx->array_hints[i] = 0;
+		ctx->object_hints[i] = 0;
+	}
+}
+
+/*
+ * forgets the remembered shapes while keeping the table.
+ * Shapes are only shared within one document, so that documents
+ * parsed by one Ctx can still be freed on different threads.
+ */
+static void ctx_forget_shapes(Ctx * ctx) {
+	size_t i;
+	for (i = 0; i < ctx->shape_capacity; i++) {
+		ctx->shapes[i] = NULL;
+	}
+	ctx->shape_count = 0;
+}
+
+/* a Ctx can parse any number of documents, reusing its scratch memory */
+static JSONValue * ctx_parse(Ctx * ctx, const char * string, ptrdiff_t len) {
+	JSONValue * _value;
+	ctx->lexer = lexer_new(string, len);
+	ctx->raw_live = ctx->options->raw_path_count >= JSON_MAX_RAW_PATHS ? (unsigned long)-1 : (1UL << ctx->options->raw_path_count) - 1;
+	ctx->raw_level = 0;
+	_value = value(next_token(ctx), ctx);
+	if (_value) {
+		Token rest = next_token(ctx);
+		if (rest.type != TT_EOF) {
+			ctx_drop_token(ctx, rest);
+			json_free(_value, ctx->allocator);
+			_value = NULL;
+		}
+	}
+	ctx_forget_shapes(ctx);
+	deduper_forget(&ctx->deduper);
+	return _value;
+}
+
+static void ctx_deinit(Ctx * ctx) {
+	FREE_ARRAY(ctx, ctx->shapes, ctx->shape_capacity);
+	deduper_deinit(&ctx->deduper);
+}
+
+JSONValue * json_parse_with_options(const char * string, ptrdiff_t len, JSONAllocator allocator, const JSONParseOptions * options) {
+	Ctx ctx;
+	JSONValue * _value;
+	ctx_init(&ctx, allocator, options);
+	_value = ctx_parse(&ctx, string, len);
+	ctx_deinit(&ctx);
+	return _value;
+}
+
+/*
+ * The step parser keeps the containers being parsed on an explicit stack
+ * instead of the call stack, so that it can stop between any two tokens.
+ */
+typedef struct {
+	Members members;
+	int is_object;
+	const char * begin; /* of the container's text, for its span */
+	char * key; /* of the member whose value is being parsed */
+	size_t key_length;
+	unsigned long live; /* the raw paths as they were outside the container */
+	size_t level;
+} Frame;
+
+typedef enum {
+	STEP_IDLE,
+	STEP_VALUE, /* a value comes next */
+	STEP_ELEMENT, /* a value or ']' comes next, as trailing commas are allowed */
+	STEP_KEY, /* a key or '}' comes next */
+	STEP_AFTER_VALUE, /* ',' or the end of the container comes next */
+	STEP_DONE
+} StepState;
+
+struct JSONParser {
+	Ctx ctx;
+	JSONParseOptions options;
+	Frame * frames;
+	size_t frame_count;
+	size_t frame_capacity;
+	StepState state;
+	JSONValue * result;
+};
+
+JSONParser * json_parser_new(JSONAllocator allocator, const JSONParseOptions * options) {
+	JSONParser * parser = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONParser));
+	if (!parser) {
+		return NULL;
+	}
+	parser->options = options ? *options : json_default_parse_options();
+	ctx_init(&parser->ctx, allocator, &parser->options);
+	parser->frames = NULL;
+	parser->frame_count = 0;
+	parser->frame_capacity = 0;
+	parser->state = STEP_IDLE;
+	parser->result = NULL;
+	return parser;
+}
+
+JSONValue * json_parser_parse(JSONParser * parser, const char * string, ptrdiff_t len) {
+	json_parser_cancel(parser);
+	return ctx_parse(&parser->ctx, string, len);
+}
+
+void json_parser_free(JSONParser * parser) {
+	JSONAllocator allocator = parser->ctx.allocator;
+	json_parser_cancel(parser);
+	FREE_ARRAY(&parser->ctx, parser->frames, parser->frame_capacity);
+	ctx_deinit(&parser->ctx);
+	allocator_free(parser, sizeof(JSONParser), allocator);
+}
+
+void json_parser_begin(JSONParser * parser, const char * string, ptrdiff_t len) {
+	Ctx * ctx = &parser->ctx;
+	json_parser_cancel(parser);
+	ctx->lexer = lexer_new(string, len);
+	ctx->raw_live = ctx->options->raw_path_count >= JSON_MAX_RAW_PATHS ? (unsigned long)-1 : (1UL << ctx->options->raw_path_count) - 1;
+	ctx->raw_level = 0;
+	ctx->depth = 0;
+	parser->state = STEP_VALUE;
+}
+
+void json_parser_cancel(JSONParser * parser) {
+	Ctx * ctx = &parser->ctx;
+	while (parser->frame_count > 0) {
+		Frame * frame = &parser->frames[--parser->frame_count];
+		if (frame->key) {
+			allocator_free(frame->key, frame->key_length + 1, ctx->allocator);
+		}
+		members_free(ctx, &frame->members);
+	}
+	if (parser->result) {
+		json_free(parser->result, ctx->allocator);
+		parser->result = NULL;
+	}
+	if (parser->state != STEP_IDLE) {
+		ctx_forget_shapes(ctx);
+		deduper_forget(&ctx->deduper);
+		parser->state = STEP_IDLE;
+	}
+}
+
+JSONValue * json_parser_result(JSONParser * parser) {
+	JSONValue * result = parser->result;
+	if (parser->state != STEP_DONE) {
+		return NULL;
+	}
+	parser->result = NULL;
+	parser->state = STEP_IDLE;
+	return result;
+}
+
+static int step_push(JSONParser * parser, int is_object) {
+	Ctx * ctx = &parser->ctx;
+	Frame * frame;
+	if (parser->frame_count == parser->frame_capacity) {
+		size_t new_capacity = parser->frame_capacity ? parser->frame_capacity * 2 : 16;
+		Frame * frames = ctx_grow_array(ctx, parser->frames, parser->frame_capacity, new_capacity, sizeof(*frames));
+		if (!frames) {
+			return 0;
+		}
+		parser->frames = frames;
+		parser->frame_capacity = new_capacity;
+	}
+	frame = &parser->frames[parser->frame_count++];
+	++ctx->depth;
+	members_init(&frame->members, ctx_size_hint(is_object ? ctx->object_hints : ctx->array_hints, ctx->depth));
+	frame->is_object = is_object;
+	frame->begin = ctx->token_begin;
+	frame->key = NULL;
+	frame->live = ctx->raw_live;
+	frame->level = ctx->raw_level;
+	if (!is_object) {
+		/* paths only go through objects */
+		ctx->raw_live = 0;
+	}
+	parser->state = is_object ? STEP_KEY : STEP_ELEMENT;
+	return 1;
+}
+
+/* hands a finished value to the container being parsed, or makes it the result */
+static int step_deliver(JSONParser * parser, JSONValue * nvalue) {
+	Ctx * ctx = &parser->ctx;
+	Frame * frame;
+	if (!nvalue) {
+		return 0;
+	}
+	parser->state = STEP_AFTER_VALUE;
+	if (parser->frame_count == 0) {
+		parser->result = nvalue;
+		return 1;
+	}
+	frame = &parser->frames[parser->frame_count - 1];
+	if (frame->is_object) {
+		ctx->raw_live = frame->live;
+		ctx->raw_level = frame->level;
+	}
+	if (!members_push(ctx, &frame->members, frame->key, frame->key_length, nvalue)) {
+		frame->key = NULL;
+		return 0;
+	}
+	frame->key = NULL;
+	return 1;
+}
+
+static int step_pop(JSONParser * parser) {
+	Ctx * ctx = &parser->ctx;
+	Frame * frame = &parser->frames[--parser->frame_count];
+	JSONValue * container;
+	--ctx->depth;
+	ctx->raw_live = frame->live;
+	ctx->raw_level = frame->level;
+	if (frame->is_object) {
+		container = (JSONValue *)members_finish_object(ctx, &frame->members);
+	} else {
+		container = (JSONValue *)members_finish_array(ctx, &frame->members);
+	}
+	if (!container) {
+		return 0;
+	}
+	ctx_set_span(container, frame->begin, ctx->lexer.begin);
+	if (ctx->options->dedup) {
+		container = deduper_intern(&ctx->deduper, container);
+	}
+	return step_deliver(parser, container);
+}
+
+/* reads the key and colon of a member, and its value when it isn't parsed token by token */
+static int step_key(JSONParser * parser, Token token) {
+	Ctx * ctx = &parser->ctx;
+	Frame * frame = &parser->frames[parser->frame_count - 1];
+	unsigned long matched = frame->live;
+	JSONValue * nvalue;
+	int parse_later;
+	if (token.type != TT_STRING) {
+		return 0;
+	}
+	frame->key = token.as.string;
+	frame->key_length = token.length;
+	token = next_token(ctx);
+	if (token.type != TT_COLON) {
+		ctx_drop_token(ctx, token);
+		return 0;
+	}
+	nvalue = member_value(ctx, &matched, frame->level, frame->key, frame->key_length, &parse_later);
+	if (!parse_later) {
+		return step_deliver(parser, nvalue);
+	}
+	ctx->raw_live = matched;
+	ctx->raw_level = frame->level + 1;
+	parser->state = STEP_VALUE;
+	return 1;
+}
+
+static int step_value(JSONParser * parser, Token token) {
+	switch (token.type) {
+	case TT_LBRACKET:
+		return step_push(parser, 0);
+	case TT_LBRACE:
+		return step_push(parser, 1);
+	default:
+		return step_deliver(parser, value(token, &parser->ctx));
+	}
+}
+
+static int step_after_value(JSONParser * parser, Token token) {
+	Frame * frame;
+	if (parser->frame_count == 0) {
+		if (token.type != TT_EOF) {
+			return 0;
+		}
+		parser->state = STEP_DONE;
+		return 1;
+	}
+	frame = &parser->frames[parser->frame_count - 1];
+	if (token.type == TT_COMMA) {
+		parser->state = frame->is_object ? STEP_KEY : STEP_ELEMENT;
+		return 1;
+	}
+	if (token.type != (frame->is_object ? TT_RBRACE : TT_RBRACKET)) {
+		return 0;
+	}
+	return step_pop(parser);
+}
+
+JSONParseStatus json_parse_step(JSONParser * parser, size_t max_bytes) {
+	Ctx * ctx = &parser->ctx;
+	const char * start = ctx->lexer.begin;
+	if (parser->state == STEP_DONE) {
+		return JSON_PARSE_DONE;
+	}
+	if (parser->state == STEP_IDLE) {
+		return JSON_PARSE_ERROR;
+	}
+	do {
+		Token token = next_token(ctx);
+		StepState state = parser->state;
+		int valid;
+		switch (state) {
+		case STEP_ELEMENT:
+			valid = token.type == TT_RBRACKET ? step_pop(parser) : step_value(parser, token);
+			break;
+		case STEP_VALUE:
+			valid = step_value(parser, token);
+			break;
+		case STEP_KEY:
+			valid = token.type == TT_RBRACE ? step_pop(parser) : step_key(parser, token);
+			break;
+		default:
+			valid = step_after_value(parser, token);
+			break;
+		}
+		if (!valid) {
+			if (state == STEP_AFTER_VALUE) {
+				ctx_drop_token(ctx, token);
+			}
+			json_parser_cancel(parser);
+			return JSON_PARSE_ERROR;
+		}
+		if (parser->state == STEP_DONE) {
+			ctx_forget_shapes(ctx);
+			deduper_forget(&ctx->deduper);
+			return JSON_PARSE_DONE;
+		}
+	} while (max_bytes == 0 || (size_t)(ctx->lexer.begin - start) < max_bytes);
+	return JSON_PARSE_MORE;
+}
+
+/*
+ * UTF-16 and UTF-32 input is transcoded to UTF-8 WIDE_WINDOW units at a time, into a window
+ * from the allocator that the step parser reads, and which it empties before the next units
+ * are transcoded. The window only grows past that for a token, or a raw value, that doesn't fit.
+ * ASCII, which all of a document's structure is, is narrowed a block at a time with SSE2.
+ */
+typedef struct {
+	const void * units;
+	size_t begin; /* past the byte order mark */
+	size_t len;
+	int wide; /* UTF-32 rather than UTF-16 */
+	int swapped; /* the byte order mark was in the opposite order */
+} WideText;
+
+static unsigned long wide_unit(const WideText * text, size_t i) {
+	unsigned long unit;
+	if (!text->wide) {
+		unit = ((const JSONChar16 *)text->units)[i] & 0xFFFFUL;
+		return text->swapped ? (unit & 0xFF) << 8 | unit >> 8 : unit;
+	}
+	unit = ((const JSONChar32 *)text->units)[i] & 0xFFFFFFFFUL;
+	if (text->swapped) {
+		unit = ((unit & 0xFF) << 24 | (unit & 0xFF00) << 8 | (unit >> 8 & 0xFF00) | unit >> 24) & 0xFFFFFFFFUL;
+	}
+	return unit;
+}
+
+#define WIDE_BLOCK 16
+#define WIDE_WINDOW 4096
+
+#ifdef JSON_USE_SSE2
+/* narrows the WIDE_BLOCK units at i into out if all of them are ASCII, returning whether they were */
+static int wide_ascii_block(const WideText * text, size_t i, char * out) {
+	__m128i high = _mm_set1_epi16((short)0xFF80);
+	__m128i narrow;
+	if (sizeof(JSONChar16) != 2 || sizeof(JSONChar32) != 4 || (text->wide && text->swapped)) {
+		return 0;
+	}
+	if (!text->wide) {
+		const JSONChar16 * units = (const JSONChar16 *)text->units + i;
+		__m128i a = _mm_loadu_si128((const __m128i *)units);
+		__m128i b = _mm_loadu_si128((const __m128i *)(units + 8));
+		if (text->swapped) {
+			a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+			b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), high), _mm_setzero_si128())) != 0xFFFF) {
+			return 0;
+		}
+		narrow = _mm_packus_epi16(a, b);
+	} else {
+		const JSONChar32 * units = (const JSONChar32 *)text->units + i;
+		__m128i a = _mm_loadu_si128((const __m128i *)units);
+		__m128i b = _mm_loadu_si128((const __m128i *)(units + 4));
+		__m128i c = _mm_loadu_si128((const __m128i *)(units + 8));
+		__m128i d = _mm_loadu_si128((const __m128i *)(units + 12));
+		__m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, _mm_set1_epi32(~0x7F)), _mm_setzero_si128())) != 0xFFFF) {
+			return 0;
+		}
+		narrow = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+	}
+	_mm_storeu_si128((__m128i *)out, narrow);
+	return 1;
+}
+#else
+static int wide_ascii_block(const WideText * text, size_t i, char * out) {
+	size_t j;
+	for (j = 0; j < WIDE_BLOCK; j++) {
+		if (wide_unit(text, i + j) >= 0x80) {
+			return 0;
+		}
+	}
+	for (j = 0; j < WIDE_BLOCK; j++) {
+		out[j] = (char)wide_unit(text, i + j);
+	}
+	return 1;
+}
+#endif
+
+/* writes the units [i, end) as UTF-8 into out, which has room for 4 bytes a unit, returning the size or (size_t)-1 if they are invalid */
+static size_t wide_transcode(const WideText * text, size_t i, size_t end, char * out) {
+	size_t size = 0;
+	size_t scalar_end = i; /* past a block that wasn't all ASCII */
+	while (i < end) {
+		unsigned long c;
+		size_t length;
+		if (i >= scalar_end && end - i >= WIDE_BLOCK) {
+			if (wide_ascii_block(text, i, out + size)) {
+				i += WIDE_BLOCK;
+				size += WIDE_BLOCK;
+				continue;
+			}
+			scalar_end = i + WIDE_BLOCK;
+		}
+		c = wide_unit(text, i++);
+		if (c < 0x80) {
+			out[size++] = (char)c;
+			continue;
+		}
+		if (!text->wide && c >= 0xD800 && c <= 0xDBFF && i < end) {
+			unsigned long low = wide_unit(text, i);
+			if (low >= 0xDC00 && low <= 0xDFFF) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				++i;
+			}
+		}
+		/* which also rejects unpaired surrogates */
+		length = encode_unverified_codepoint(out + size, c);
+		if (length == 0) {
+			return (size_t)-1;
+		}
+		size += length;
+	}
+	return size;
+}
+
+/*
+ * The parser is stepped up to the last ',', '[', '{', ']' or '}' outside strings in the window,
+ * so that every token it reads lies in the window, as does the value it reads along with a key
+ * that is decoded from base64. Raw values are read whole, so it isn't stepped into containers
+ * deeper than raw paths reach.
+ */
+typedef struct {
+	int in_string;
+	int escaped;
+	size_t depth;
+	size_t max_depth; /* of the points the parser may stop at */
+} WideCuts;
+
+/* returns the last point in bytes [i, end) the parser may stop at, or 0 if there is none */
+static size_t wide_find_cut(WideCuts * cuts, const char * bytes, size_t i, size_t end) {
+	size_t cut = 0;
+	for (; i < end; i++) {
+		if (cuts->in_string) {
+			if (cuts->escaped) {
+				cuts->escaped = 0;
+			} else if (bytes[i] == '\\') {
+				cuts->escaped = 1;
+			} else if (bytes[i] == '"') {
+				cuts->in_string = 0;
+			}
+			continue;
+		}
+		switch (bytes[i]) {
+		case '"':
+			cuts->in_string = 1;
+			continue;
+		case '[':
+		case '{':
+			++cuts->depth;
+			break;
+		case ']':
+		case '}':
+			if (cuts->depth > 0) {
+				--cuts->depth;
+			}
+			break;
+		case ',':
+			break;
+		default:
+			continue;
+		}
+		if (cuts->depth <= cuts->max_depth) {
+			cut = i + 1;
+		}
+	}
+	return cut;
+}
+
+static JSONValue * parse_wide(WideText * text, JSONAllocator allocator, const JSONParseOptions * options) {
+	JSONParseOptions defaults = json_default_parse_options();
+	JSONParser * parser;
+	JSONParseStatus status;
+	WideCuts cuts;
+	unsigned long first;
+	char * window;
+	size_t capacity = 8 * WIDE_WINDOW; /* a transcoded window, and what is left of the last one */
+	size_t filled = 0; /* bytes of the window transcoded */
+	size_t next; /* the first unit not transcoded */
+	size_t i;
+	JSONValue * value = NULL;
+	if (!options) {
+		options = &defaults;
+	}
+	if (options->retain_spans) {
+		return NULL;
+	}
+	text->begin = 0;
+	text->swapped = 0;
+	first = text->len > 0 ? wide_unit(text, 0) : 0;
+	if (first == 0xFEFF) {
+		text->begin = 1;
+	} else if (first == (text->wide ? 0xFFFE0000UL : 0xFFFEUL)) {
+		text->begin = 1;
+		text->swapped = 1;
+	}
+	next = text->begin;
+	cuts.in_string = 0;
+	cuts.escaped = 0;
+	cuts.depth = 0;
+	cuts.max_depth = options->raw_path_count > 0 ? 0 : (size_t)-1;
+	for (i = 0; i < options->raw_path_count && i < JSON_MAX_RAW_PATHS; i++) {
+		const char * dot = options->raw_paths[i];
+		size_t segments = 1;
+		while ((dot = strchr(dot, '.')) != NULL) {
+			++dot;
+			++segments;
+		}
+		if (segments > cuts.max_depth) {
+			cuts.max_depth = segments;
+		}
+	}
+	parser = json_parser_new(allocator, options);
+	if (!parser) {
+		return NULL;
+	}
+	window = ctx_reallocate(&parser->ctx, NULL, 0, capacity);
+	if (!window) {
+		json_parser_free(parser);
+		return NULL;
+	}
+	json_parser_begin(parser, window, 0);
+	do {
+		size_t parsed = parser->ctx.lexer.begin - window;
+		size_t cut = 0;
+		/* what was parsed is dropped, and what is left had no point to stop at */
+		memmove(window, window + parsed, filled - parsed);
+		filled -= parsed;
+		while (cut == 0 && next < text->len) {
+			size_t end = text->len - next > WIDE_WINDOW ? next + WIDE_WINDOW : text->len;
+			size_t size;
+			unsigned long last;
+			/* keeping surrogate pairs together */
+			last = wide_unit(text, end - 1);
+			if (!text->wide && end < text->len && last >= 0xD800 && last <= 0xDBFF) {
+				++end;
+			}
+			if (capacity - filled < 4 * (end - next)) {
+				size_t new_capacity = capacity * 2 > filled + 4 * (end - next) ? capacity * 2 : filled + 4 * (end - next);
+				char * new_window = ctx_grow_array(&parser->ctx, window, capacity, new_capacity, 1);
+				if (!new_window) {
+					goto done;
+				}
+				window = new_window;
+				capacity = new_capacity;
+			}
+			size = wide_transcode(text, next, end, window + filled);
+			if (size == (size_t)-1) {
+				goto done;
+			}
+			cut = wide_find_cut(&cuts, window, filled, filled + size);
+			filled += size;
+			next = end;
+		}
+		if (next == text->len) {
+			cut = filled;
+		}
+		parser->ctx.lexer = lexer_new(window, cut);
+		/* the last window is parsed to its end */
+		status = json_parse_step(parser, next == text->len ? 0 : cut);
+	} while (status == JSON_PARSE_MORE);
+	if (status == JSON_PARSE_DONE) {
+		value = json_parser_result(parser);
+	}
+done:
+	allocator_free(window, capacity, allocator);
+	json_parser_free(parser);
+	return value;
+}
+
+JSONValue * json_parse_utf16(const JSONChar16 * input, ptrdiff_t len, JSONAllocator allocator, const JSONParseOptions * options) {
+	WideText text;
+	text.units = input;
+	text.wide = 0;
+	if (len == -1) {
+		for (len = 0; input[len]; len++);
+	}
+	text.len = len;
+	return parse_wide(&text, allocator, options);
+}
+
+JSONValue * json_parse_utf32(const JSONChar32 * input, ptrdiff_t len, JSONAllocator allocator, const JSONParseOptions * options) {
+	WideText text;
+	text.units = input;
+	text.wide = 1;
+	if (len == -1) {
+		for (len = 0; input[len]; len++);
+	}
+	text.len = len;
+	return parse_wide(&text, allocator, options);
+}
+
+typedef struct {
+	const char * const * inputs;
+	const ptrdiff_t * lens;
+	size_t n;
+	JSONValue ** results;
+	size_t * workers;
+	const JSONAllocator * allocators;
+	const JSONParseOptions * options;
+	size_t next; /* the number of documents claimed by the workers so far */
+	size_t * parsed; /* per worker */
+} Batch;
+
+/*
+ * each worker claims the next unparsed document until none are left, so a worker
+ * stuck on a large document doesn't hold up the rest. It parses them all with a
+ * single Ctx, so its scratch state is reused.
+ */
+static void batch_worker(void * arg, size_t w) {
+	Batch * batch = arg;
+	Ctx ctx;
+	ctx_init(&ctx, batch->allocators[w], batch->options);
+	batch->parsed[w] = 0;
+	for (;;) {
+		size_t i = ATOMIC_INCREMENT(batch->next) - 1;
+		if (i >= batch->n) {
+			break;
+		}
+		batch->results[i] = ctx_parse(&ctx, batch->inputs[i], batch->lens[i]);
+		batch->parsed[w] += batch->results[i] != NULL;
+		if (batch->workers) {
+			batch->workers[i] = w;
+		}
+	}
+	ctx_deinit(&ctx);
+}
+
+size_t json_parse_batch(const char * const * inputs, const ptrdiff_t * lens, size_t n, JSONValue ** results, size_t * workers, const JSONAllocator * allocators, size_t nworkers, const JSONParseOptions * options, JSONExecutor executor) {
+	JSONParseOptions default_options = json_default_parse_options();
+	Batch batch;
+	size_t parsed = 0;
+	size_t w;
+	if (nworkers > n) {
+		nworkers = n;
+	}
+	if (nworkers == 0) {
+		return 0;
+	}
+	batch.inputs = inputs;
+	batch.lens = lens;
+	batch.n = n;
+	batch.results = results;
+	batch.workers = workers;
+	batch.allocators = allocators;
+	batch.options = options ? options : &default_options;
+	batch.next = 0;
+	batch.parsed = allocators[0].callback(allocators[0].ctx, NULL, 0, nworkers * sizeof(*batch.parsed));
+	if (!batch.parsed) {
+		for (w = 0; w < n; w++) {
+			results[w] = NULL;
+		}
+		return 0;
+	}
+	executor.callback(executor.ctx, batch_worker, &batch, nworkers);
+	for (w = 0; w < nworkers; w++) {
+		parsed += batch.parsed[w];
+	}
+	allocator_free_array(batch.parsed, nworkers, sizeof(*batch.parsed), allocators[0]);
+	return parsed;
+}
+
+JSONExecutor json_executor_new(void * ctx, JSONExecutorCallback callback) {
+	JSONExecutor executor;
+	executor.ctx = ctx;
+	executor.callback = callback;
+	return executor;
+}
+
+static void serial_executor_callback(void * ctx, JSONTask task, void * arg, size_t count) {
+	size_t i;
+	(void)ctx;
+	for (i = 0; i < count; i++) {
+		task(arg, i);
+	}
+}
+
+JSONExecutor json_serial_executor(void) {
+	JSONExecutor executor;
+	executor.ctx = NULL;
+	executor.callback = serial_executor_callback;
+	return executor;
+}
+
+JSONAllocator json_allocator_new(void * ctx, JSONAllocatorCallback callback) {
+	JSONAllocator allocator;
+	allocator.ctx = ctx;
+	allocator.callback = callback;
+	allocator.flags = 0;
+	allocator.free_all = NULL;
+	return allocator;
+}
+
+int json_allocator_free_all(JSONAllocator allocator) {
+	if (!allocator.free_all) {
+		return 0;
+	}
+	allocator.free_all(allocator.ctx);
+	return 1;
+}
+
+static void * default_allocator_callback(void * ctx, void * old_alloc, size_t old_size, size_t new_size) {
+	(void)ctx;
+	(void)old_size;
+	return realloc(old_alloc, new_size);
+}
+
+JSONAllocator json_default_allocator(void) {
+	/* the system allocator uses global state, but ctx is set so that allocators can be compared */
+	return json_allocator_new(NULL, default_allocator_callback);
+}
+
+/*
+ * The caching allocator keeps freed blocks of up to CACHE_MAX_SIZE bytes on
+ * free lists, one per multiple of CACHE_GRANULE, which the next allocation
+ * of that size class takes from before going to the inner allocator.
+ * Blocks are always allocated from the inner allocator at their class size.
+ */
+#define CACHE_GRANULE 8
+#define CACHE_MAX_SIZE 256
+#define CACHE_CLASSES (CACHE_MAX_SIZE / CACHE_GRANULE)
+
+typedef struct CachedBlock {
+	struct CachedBlock * next;
+} CachedBlock;
+
+struct JSONCachingAllocator {
+	JSONAllocator inner;
+	CachedBlock * free_lists[CACHE_CLASSES];
+};
+
+static size_t cache_class(size_t size) {
+	return (size - 1) / CACHE_GRANULE;
+}
+
+static size_t cache_class_size(size_t class) {
+	return (class + 1) * CACHE_GRANULE;
+}
+
+static void * cache_take(JSONCachingAllocator * cache, size_t size) {
+	size_t class = cache_class(size);
+	CachedBlock * block = cache->free_lists[class];
+	if (block) {
+		cache->free_lists[class] = block->next;
+		return block;
+	}
+	return cache->inner.callback(cache->inner.ctx, NULL, 0, cache_class_size(class));
+}
+
+static void cache_put(JSONCachingAllocator * cache, void * alloc, size_t size) {
+	size_t class = cache_class(size);
+	CachedBlock * block = alloc;
+	block->next = cache->free_lists[class];
+	cache->free_lists[class] = block;
+}
+
+static void * caching_allocator_callback(void * ctx, void * old_alloc, size_t old_size, size_t new_size) {
+	JSONCachingAllocator * cache = ctx;
+	int old_cached = old_alloc && old_size <= CACHE_MAX_SIZE;
+	int new_cached = new_size > 0 && new_size <= CACHE_MAX_SIZE;
+	void * new_alloc;
+	if (new_size == 0) {
+		if (old_cached) {
+			cache_put(cache, old_alloc, old_size);
+		} else {
+			allocator_free(old_alloc, old_size, cache->inner);
+		}
+		return NULL;
+	}
+	if (!old_alloc) {
+		if (new_cached) {
+			return cache_take(cache, new_size);
+		}
+		return cache->inner.callback(cache->inner.ctx, NULL, 0, new_size);
+	}
+	if (old_cached && new_cached && cache_class(old_size) == cache_class(new_size)) {
+		return old_alloc;
+	}
+	if (!old_cached && !new_cached) {
+		return cache->inner.callback(cache->inner.ctx, old_alloc, old_size, new_size);
+	}
+	/* moving between size classes, or in or out of the cached sizes */
+	if (new_cached) {
+		new_alloc = cache_take(cache, new_size);
+	} else {
+		new_alloc = cache->inner.callback(cache->inner.ctx, NULL, 0, new_size);
+	}
+	if (!new_alloc) {
+		return NULL;
+	}
+	memcpy(new_alloc, old_alloc, old_size < new_size ? old_size : new_size);
+	caching_allocator_callback(ctx, old_alloc, old_size, 0);
+	return new_alloc;
+}
+
+JSONCachingAllocator * json_caching_allocator_new(JSONAllocator inner) {
+	JSONCachingAllocator * cache = inner.callback(inner.ctx, NULL, 0, sizeof(JSONCachingAllocator));
+	size_t i;
+	if (!cache) {
+		return NULL;
+	}
+	cache->inner = inner;
+	for (i = 0; i < CACHE_CLASSES; i++) {
+		cache->free_lists[i] = NULL;
+	}
+	return cache;
+}
+
+JSONAllocator json_caching_allocator(JSONCachingAllocator * cache) {
+	return json_allocator_new(cache, caching_allocator_callback);
+}
+
+void json_caching_allocator_trim(JSONCachingAllocator * cache) {
+	size_t i;
+	for (i = 0; i < CACHE_CLASSES; i++) {
+		while (cache->free_lists[i]) {
+			CachedBlock * block = cache->free_lists[i];
+			cache->free_lists[i] = block->next;
+			allocator_free(block, cache_class_size(i), cache->inner);
+		}
+	}
+}
+
+void json_caching_allocator_free(JSONCachingAllocator * cache) {
+	JSONAllocator inner = cache->inner;
+	json_caching_allocator_trim(cache);
+	allocator_free(cache, sizeof(JSONCachingAllocator), inner);
+}
+
+/*
+ * The arena hands out memory from chunks of whole 2 MB pages, by bumping an offset.
+ * Chunks are mapped with explicit huge pages when the system has them reserved,
+ * otherwise with transparent huge pages requested through madvise,
+ * and with malloc where mmap isn't used.
+ * Freeing does nothing; json_allocator_free_all rewinds the arena to reuse its chunks.
+ */
+#define ARENA_PAGE_SIZE ((size_t)2 << 20)
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaChunk {
+	struct ArenaChunk * next;
+	size_t size; /* including the header */
+	int mapped;
+} ArenaChunk;
+
+#define ARENA_HEADER_SIZE ((sizeof(ArenaChunk) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+struct JSONArena {
+	ArenaChunk * first;
+	ArenaChunk * current;
+	size_t used; /* the offset of the free space in current */
+	char * last; /* the last allocation, which can be resized in place */
+	size_t chunk_size;
+};
+
+static ArenaChunk * arena_map_chunk(size_t size) {
+	ArenaChunk * chunk;
+#ifdef JSON_USE_MMAP
+	void * memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (memory == MAP_FAILED) {
+		memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+		if (memory != MAP_FAILED) {
+			/* only a hint, so failing is fine */
+			madvise(memory, size, MADV_HUGEPAGE);
+		}
+#endif
+	}
+	if (memory != MAP_FAILED) {
+		chunk = memory;
+		chunk->mapped = 1;
+		chunk->size = size;
+		chunk->next = NULL;
+		return chunk;
+	}
+#endif
+	chunk = malloc(size);
+	if (!chunk) {
+		return NULL;
+	}
+	chunk->mapped = 0;
+	chunk->size = size;
+	chunk->next = NULL;
+	return chunk;
+}
+
+static void arena_unmap_chunk(ArenaChunk * chunk) {
+#ifdef JSON_USE_MMAP
+	if (chunk->mapped) {
+		munmap(chunk, chunk->size);
+		return;
+	}
+#endif
+	free(chunk);
+}
+
+/* rounds size up to whole pages, or returns 0 on overflow */
+static size_t arena_round_size(size_t size) {
+	if (size > ((size_t)-1) - ARENA_PAGE_SIZE) {
+		return 0;
+	}
+	return (size + ARENA_PAGE_SIZE - 1) & ~(ARENA_PAGE_SIZE - 1);
+}
+
+static void * arena_bump(JSONArena * arena, size_t size) {
+	ArenaChunk * chunk = arena->current;
+	size_t begin = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+	if (size > chunk->size - begin) {
+		/* moves on to a chunk kept from before a rewind, or maps a new one */
+		ArenaChunk * next = chunk->next;
+		if (!next || size > next->size - ARENA_HEADER_SIZE) {
+			size_t chunk_size = arena->chunk_size;
+			if (size > chunk_size - ARENA_HEADER_SIZE) {
+				chunk_size = arena_round_size(size + ARENA_HEADER_SIZE);
+				if (chunk_size == 0 || size > ((size_t)-1) - ARENA_HEADER_SIZE) {
+					return NULL;
+				}
+			}
+			next = arena_map_chunk(chunk_size);
+			if (!next) {
+				return NULL;
+			}
+			next->next = chunk->next;
+			chunk->next = next;
+		}
+		arena->current = chunk = next;
+		begin = ARENA_HEADER_SIZE;
+	}
+	arena->used = begin + size;
+	arena->last = (char *)chunk + begin;
+	return arena->last;
+}
+
+static void * arena_allocator_callback(void * ctx, void * old_alloc, size_t old_size, size_t new_size) {
+	JSONArena * arena = ctx;
+	char * new_alloc;
+	if (new_size == 0) {
+		return NULL;
+	}
+	if (old_alloc && old_alloc == arena->last) {
+		size_t begin = (char *)old_alloc - (char *)arena->current;
+		if (new_size <= arena->current->size - begin) {
+			arena->used = begin + new_size;
+			return old_alloc;
+		}
+	}
+	if (old_alloc && new_size <= old_size) {
+		return old_alloc;
+	}
+	new_alloc = arena_bump(arena, new_size);
+	if (new_alloc && old_alloc) {
+		memcpy(new_alloc, old_alloc, old_size);
+	}
+	return new_alloc;
+}
+
+static void arena_rewind(void * ctx) {
+	JSONArena * arena = ctx;
+	arena->current = arena->first;
+	arena->used = ARENA_HEADER_SIZE;
+	arena->last = NULL;
+}
+
+JSONArena * json_arena_new(size_t chunk_size) {
+	JSONArena * arena = malloc(sizeof(JSONArena));
+	if (!arena) {
+		return NULL;
+	}
+	arena->chunk_size = arena_round_size(chunk_size > 0 ? chunk_size : ARENA_PAGE_SIZE);
+	arena->first = arena->chunk_size ? arena_map_chunk(arena->chunk_size) : NULL;
+	if (!arena->first) {
+		free(arena);
+		return NULL;
+	}
+	arena_rewind(arena);
+	return arena;
+}
+
+JSONAllocator json_arena_allocator(JSONArena * arena) {
+	JSONAllocator allocator = json_allocator_new(arena, arena_allocator_callback);
+	allocator.flags = JSON_ALLOCATOR_FREE_NOOP;
+	allocator.free_all = arena_rewind;
+	return allocator;
+}
+
+void json_arena_free(JSONArena * arena) {
+	ArenaChunk * chunk = arena->first;
+	while (chunk) {
+		ArenaChunk * next = chunk->next;
+		arena_unmap_chunk(chunk);
+		chunk = next;
+	}
+	free(arena);
+}
+
+/* returns the values held by a container, setting count to 0 for scalars */
+static JSONValue ** value_children(const JSONValue * value, size_t * count) {
+	switch (value->type) {
+	case JSON_OBJ:
+		*count = ((const JSONObject *)value)->count;
+		return ((const JSONObject *)value)->values;
+	case JSON_ARRAY:
+		*count = ((const JSONArray *)value)->size;
+		return ((const JSONArray *)value)->values;
+	default:
+		*count = 0;
+		return NULL;
+	}
+}
+
+/* frees everything owned by value, except for the values it holds */
+static void free_shell(JSONValue * value, JSONAllocator allocator) {
+	JSONObject * obj;
+	JSONArray * array;
+	JSONString * string;
+	JSONBinary * binary;
+	JSONRaw * raw;
+	switch (value->type) {
+	case JSON_OBJ:
+		obj = (JSONObject *)value;
+		shape_release(obj->shape);
+		allocator_free_array(obj->values, obj->count, sizeof(*obj->values), allocator);
+		allocator_free(obj, value_size(value), allocator);
+		break;
+	case JSON_ARRAY:
+		array = (JSONArray *)value;
+		allocator_free_array(array->values, array->size, sizeof(*array->values), allocator);
+		allocator_free(array, value_size(value), allocator);
+		break;
+	case JSON_STRING:
+		string = (JSONString *)value;
+		allocator_free(string->string, string->length + 1, allocator);
+		allocator_free(string, value_size(value), allocator);
+		break;
+	case JSON_BINARY:
+		binary = (JSONBinary *)value;
+		allocator_free(binary->bytes, binary->length, allocator);
+		allocator_free(binary, value_size(value), allocator);
+		break;
+	case JSON_RAW:
+		raw = (JSONRaw *)value;
+		allocator_free(raw->text, raw->length + 1, allocator);
+		allocator_free(raw, value_size(value), allocator);
+		break;
+	case JSON_NUMBER:
+		allocator_free(value, value_size(value), allocator);
+		break;
+	case JSON_BOOL:
+	case JSON_NULL:
+		break;
+	}
+}
+
+/*
+ * Values hold a count of their owners, so that documents and subtrees can be shared.
+ * A count of 0 marks values that are never freed, like the singletons and static documents.
+ * An owner seeing a count of 1 is the only one, and skips the atomic decrement.
+ * That count is loaded with acquire ordering, so the other owners' last uses of
+ * the value, which released it with their decrements, happen before it is freed.
+ */
+static int value_drop_ref(JSONValue * value) {
+	unsigned int refs = ATOMIC_LOAD_ACQUIRE(value->refs);
+	if (refs == 0) {
+		return 0;
+	}
+	return refs == 1 || ATOMIC_DECREMENT(value->refs) == 0;
+}
+
+JSONValue * json_retain(JSONValue * value) {
+	if (value->refs != 0) {
+		ATOMIC_INCREMENT(value->refs);
+	}
+	return value;
+}
+
+void json_release(JSONValue * value, JSONAllocator allocator) {
+	json_free(value, allocator);
+}
+
+void json_free(JSONValue * value, JSONAllocator allocator) {
+	size_t count;
+	JSONValue ** values;
+	size_t i;
+	if ((allocator.flags & JSON_ALLOCATOR_FREE_NOOP) || !value_drop_ref(value)) {
+		return;
+	}
+	values = value_children(value, &count);
+	for (i = 0; i < count; i++) {
+		json_free(values[i], allocator);
+	}
+	free_shell(value, allocator);
+}
+
+/* Building documents from parts */
+
+static JSONShape * shape_copy(JSONShape * shape, JSONAllocator allocator);
+
+JSONValue * json_new_null(void) {
+	return &json_null;
+}
+
+JSONValue * json_new_bool(int boolean) {
+	return boolean ? &json_true : &json_false;
+}
+
+JSONValue * json_new_number(double number, JSONAllocator allocator) {
+	JSONNumber * num = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONNumber));
+	if (!num) {
+		return NULL;
+	}
+	num->value.type = JSON_NUMBER;
+	num->value.refs = 1;
+	num->value.flags = 0;
+	num->number = number;
+	return (JSONValue *)num;
+}
+
+JSONValue * json_new_string(const char * string, size_t length, JSONAllocator allocator) {
+	JSONString * str = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONString));
+	if (!str) {
+		return NULL;
+	}
+	str->string = allocator.callback(allocator.ctx, NULL, 0, length + 1);
+	if (!str->string) {
+		allocator_free(str, sizeof(JSONString), allocator);
+		return NULL;
+	}
+	memcpy(str->string, string, length);
+	str->string[length] = '\0';
+	str->value.type = JSON_STRING;
+	str->value.refs = 1;
+	str->value.flags = 0;
+	str->length = length;
+	return (JSONValue *)str;
+}
+
+JSONValue * json_new_raw(const char * text, size_t length, JSONAllocator allocator) {
+	JSONRaw * raw = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONRaw));
+	if (!raw) {
+		return NULL;
+	}
+	raw->text = allocator.callback(allocator.ctx, NULL, 0, length + 1);
+	if (!raw->text) {
+		allocator_free(raw, sizeof(JSONRaw), allocator);
+		return NULL;
+	}
+	memcpy(raw->text, text, length);
+	raw->text[length] = '\0';
+	raw->value.type = JSON_RAW;
+	raw->value.refs = 1;
+	raw->value.flags = 0;
+	raw->length = length;
+	return (JSONValue *)raw;
+}
+
+static JSONValue ** copy_values(JSONValue * const * values, size_t count, JSONAllocator allocator) {
+	JSONValue ** copy;
+	if (count == 0) {
+		return NULL;
+	}
+	if (((size_t)-1) / count < sizeof(*copy)) {
+		return NULL;
+	}
+	copy = allocator.callback(allocator.ctx, NULL, 0, count * sizeof(*copy));
+	if (copy) {
+		memcpy(copy, values, count * sizeof(*copy));
+	}
+	return copy;
+}
+
+JSONValue * json_new_array(JSONValue * const * values, size_t size, JSONAllocator allocator) {
+	JSONArray * array;
+	JSONValue ** copy = copy_values(values, size, allocator);
+	if (size > 0 && !copy) {
+		return NULL;
+	}
+	array = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONArray));
+	if (!array) {
+		allocator_free_array(copy, size, sizeof(*copy), allocator);
+		return NULL;
+	}
+	array->value.type = JSON_ARRAY;
+	array->value.refs = 1;
+	array->value.flags = 0;
+	array->values = copy;
+	array->size = size;
+	return (JSONValue *)array;
+}
+
+JSONValue * json_new_object(const char * const * keys, JSONValue * const * values, size_t count, JSONAllocator allocator) {
+	JSONObject * obj;
+	JSONShape shape;
+	JSONShape * copy;
+	JSONValue ** values_copy = copy_values(values, count, allocator);
+	if (count > 0 && !values_copy) {
+		return NULL;
+	}
+	/* the keys are copied the same way as when cloning into another allocator */
+	shape.keys = (char **)keys;
+	shape.count = count;
+	shape.refs = 1;
+	shape.hash = hash_keys(shape.keys, count);
+	shape.hint = 0;
+	shape.allocator = allocator;
+	copy = shape_copy(&shape, allocator);
+	obj = copy ? allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONObject)) : NULL;
+	if (!obj) {
+		if (copy) {
+			shape_release(copy);
+		}
+		allocator_free_array(values_copy, count, sizeof(*values_copy), allocator);
+		return NULL;
+	}
+	obj->value.type = JSON_OBJ;
+	obj->value.refs = 1;
+	obj->value.flags = 0;
+	obj->shape = copy;
+	obj->values = values_copy;
+	obj->count = count;
+	return (JSONValue *)obj;
+}
+
+/* Editing documents */
+
+void json_mark_dirty(JSONValue * value) {
+	if (value->flags & VALUE_HAS_SPAN) {
+		value->flags |= VALUE_DIRTY;
+	}
+}
+
+int json_value_span(const JSONValue * value, const char ** begin, size_t * length) {
+	const SourceSpan * span;
+	if (!value_is_clean(value)) {
+		return 0;
+	}
+	span = value_span(value);
+	*begin = span->begin;
+	*length = span->length;
+	return 1;
+}
+
+int json_array_set(JSONValue * array, size_t index, JSONValue * value, JSONAllocator allocator) {
+	JSONArray * arr = (JSONArray *)array;
+	if (array->type != JSON_ARRAY || array->refs != 1 || index > arr->size) {
+		return 0;
+	}
+	if (index == arr->size) {
+		JSONValue ** values = allocator.callback(allocator.ctx, arr->values, arr->size * sizeof(*values), (arr->size + 1) * sizeof(*values));
+		if (!values) {
+			return 0;
+		}
+		arr->values = values;
+		++arr->size;
+	} else {
+		json_free(arr->values[index], allocator);
+	}
+	arr->values[index] = value;
+	json_mark_dirty(array);
+	return 1;
+}
+
+/* a new shape holding the keys of shape followed by key */
+static JSONShape * shape_with_key(const JSONShape * shape, const char * key, JSONAllocator allocator) {
+	JSONShape extended;
+	JSONShape * copy;
+	char ** keys = allocator.callback(allocator.ctx, NULL, 0, (shape->count + 1) * sizeof(*keys));
+	if (!keys) {
+		return NULL;
+	}
+	memcpy(keys, shape->keys, shape->count * sizeof(*keys));
+	keys[shape->count] = (char *)key;
+	extended.keys = keys;
+	extended.count = shape->count + 1;
+	extended.refs = 1;
+	extended.hash = hash_keys(keys, extended.count);
+	extended.hint = 0;
+	extended.allocator = allocator;
+	copy = shape_copy(&extended, allocator);
+	allocator_free_array(keys, extended.count, sizeof(*keys), allocator);
+	return copy;
+}
+
+int json_object_set(JSONValue * object, const char * key, JSONValue * value, JSONAllocator allocator) {
+	JSONObject * obj = (JSONObject *)object;
+	JSONShape * shape;
+	JSONValue ** values;
+	size_t i;
+	if (object->type != JSON_OBJ || object->refs != 1) {
+		return 0;
+	}
+	for (i = 0; i < obj->count; i++) {
+		if (strcmp(key, obj->shape->keys[i]) == 0) {
+			json_free(obj->values[i], allocator);
+			obj->values[i] = value;
+			json_mark_dirty(object);
+			return 1;
+		}
+	}
+	/* the shape may be shared with other objects, so the key goes into a new one */
+	shape = shape_with_key(obj->shape, key, allocator);
+	if (!shape) {
+		return 0;
+	}
+	values = allocator.callback(allocator.ctx, obj->values, obj->count * sizeof(*values), (obj->count + 1) * sizeof(*values));
+	if (!values) {
+		shape_release(shape);
+		return 0;
+	}
+	shape_release(obj->shape);
+	obj->shape = shape;
+	obj->values = values;
+	obj->values[obj->count++] = value;
+	json_mark_dirty(object);
+	return 1;
+}
+
+int json_set_path(JSONValue * root, const char * path, JSONValue * value, JSONAllocator allocator) {
+	JSONValue * container = root;
+	char key[256];
+	for (;;) {
+		const char * end = strchr(path, '.');
+		size_t len = end ? (size_t)(end - path) : strlen(path);
+		JSONValue * child = NULL;
+		if (len >= sizeof(key) || container->refs != 1) {
+			return 0;
+		}
+		memcpy(key, path, len);
+		key[len] = '\0';
+		if (container->type == JSON_ARRAY) {
+			char * digits_end;
+			unsigned long index = strtoul(key, &digits_end, 10);
+			if (len == 0 || *digits_end != '\0' || key[0] == '-' || key[0] == '+') {
+				return 0;
+			}
+			if (!end) {
+				return json_array_set(container, index, value, allocator);
+			}
+			if (index < ((JSONArray *)container)->size) {
+				child = ((JSONArray *)container)->values[index];
+			}
+		} else if (container->type == JSON_OBJ) {
+			if (!end) {
+				return json_object_set(container, key, value, allocator);
+			}
+			child = (JSONValue *)json_object_get((JSONObject *)container, key);
+		}
+		if (!child) {
+			return 0;
+		}
+		/* the text of every container on the path changes with the value */
+		json_mark_dirty(container);
+		container = child;
+		path = end + 1;
+	}
+}
+
+/*
+ * Reparsing finds the innermost container whose text holds the whole edit inside its brackets,
+ * parses only its new text, and splices the result in. If that text no longer parses
+ * on its own, the containers around it are tried in turn.
+ */
+typedef struct {
+	JSONValue * container;
+	size_t index; /* in the container above */
+} ReparseLink;
+
+static JSONValue ** container_values(const JSONValue * value, size_t * count) {
+	if (value->type == JSON_ARRAY) {
+		*count = ((const JSONArray *)value)->size;
+		return ((const JSONArray *)value)->values;
+	}
+	if (value->type == JSON_OBJ) {
+		*count = ((const JSONObject *)value)->count;
+		return ((const JSONObject *)value)->values;
+	}
+	*count = 0;
+	return NULL;
+}
+
+/* whether the edit lies between the brackets of a clean container that isn't shared */
+static int reparse_encloses(const JSONValue * value, const char * old_text, size_t edit_offset, size_t removed_length) {
+	const SourceSpan * span;
+	size_t begin;
+	if ((value->type != JSON_ARRAY && value->type != JSON_OBJ) || value->refs != 1 || !value_is_clean(value)) {
+		return 0;
+	}
+	span = value_span(value);
+	begin = span->begin - old_text;
+	return edit_offset > begin && edit_offset + removed_length < begin + span->length;
+}
+
+/* moves the span of a value into the new text */
+static void reparse_rebase_span(JSONValue * value, const char * old_text, const char * new_text, size_t edit_offset, size_t removed_length, size_t inserted_length) {
+	if (value->flags & VALUE_HAS_SPAN) {
+		SourceSpan * span = value_span(value);
+		size_t begin = span->begin - old_text;
+		if (begin >= edit_offset + removed_length) {
+			begin = begin - removed_length + inserted_length;
+		} else if (begin + span->length > edit_offset) {
+			span->length = span->length - removed_length + inserted_length;
+		}
+		span->begin = new_text + begin;
+	}
+}
+
+static void reparse_rebase(JSONValue * value, const char * old_text, const char * new_text, size_t edit_offset, size_t removed_length, size_t inserted_length) {
+	JSONValue ** values;
+	size_t count;
+	size_t i;
+	reparse_rebase_span(value, old_text, new_text, edit_offset, removed_length, inserted_length);
+	values = container_values(value, &count);
+	for (i = 0; i < count; i++) {
+		reparse_rebase(values[i], old_text, new_text, edit_offset, removed_length, inserted_length);
+	}
+}
+
+/* whether a subtree holds a value that is shared, and so could be reached, and moved, twice */
+static int reparse_shared(const JSONValue * value) {
+	JSONValue ** values;
+	size_t count;
+	size_t i;
+	if (value->refs > 1) {
+		return 1;
+	}
+	values = container_values(value, &count);
+	for (i = 0; i < count; i++) {
+		if (reparse_shared(values[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The spans that have to move are those of the containers around the edit, and of the values after it.
+ * The values before it only move when the text was copied, rather than edited in place.
+ */
+#define REPARSE_MOVES(link, i, old_text, new_text) ((i) > (link)->index || ((i) < (link)->index && (new_text) != (old_text)))
+
+JSONValue * json_reparse(JSONValue * doc, const char * old_text, const char * new_text, size_t edit_offset, size_t removed_length, size_t inserted_length, JSONAllocator allocator, const JSONParseOptions * options) {
+	ReparseLink * chain = NULL;
+	size_t depth = 0;
+	size_t capacity = 0;
+	JSONValue * container = doc;
+	JSONValue * reparsed = NULL;
+	Ctx ctx;
+	if (!options || !options->retain_spans || options->dedup || !reparse_encloses(doc, old_text, edit_offset, removed_length)) {
+		return NULL;
+	}
+	ctx_init(&ctx, allocator, options);
+	for (;;) {
+		JSONValue ** values;
+		size_t count;
+		size_t i;
+		if (depth == capacity) {
+			size_t new_capacity = capacity ? capacity * 2 : 16;
+			ReparseLink * new_chain = ctx_grow_array(&ctx, chain, capacity, new_capacity, sizeof(*chain));
+			if (!new_chain) {
+				goto done;
+			}
+			chain = new_chain;
+			capacity = new_capacity;
+		}
+		chain[depth].container = container;
+		chain[depth++].index = 0;
+		/* raw paths are matched from the root */
+		if (options->raw_path_count > 0) {
+			break;
+		}
+		values = container_values(container, &count);
+		for (i = 0; i < count && !reparse_encloses(values[i], old_text, edit_offset, removed_length); i++) {
+		}
+		if (i == count) {
+			break;
+		}
+		chain[depth - 1].index = i;
+		container = values[i];
+	}
+	while (depth > 0) {
+		const SourceSpan * span = value_span(chain[--depth].container);
+		reparsed = ctx_parse(&ctx, new_text + (span->begin - old_text), span->length - removed_length + inserted_length);
+		if (reparsed) {
+			break;
+		}
+	}
+	if (reparsed) {
+		JSONValue * old = chain[depth].container;
+		size_t k;
+		for (k = 0; k < depth; k++) {
+			size_t count;
+			JSONValue ** values = container_values(chain[k].container, &count);
+			size_t i;
+			for (i = 0; i < count; i++) {
+				if (REPARSE_MOVES(&chain[k], i, old_text, new_text) && reparse_shared(values[i])) {
+					json_free(reparsed, allocator);
+					reparsed = NULL;
+					goto done;
+				}
+			}
+		}
+		if (depth > 0) {
+			size_t count;
+			container_values(chain[depth - 1].container, &count)[chain[depth - 1].index] = reparsed;
+		} else {
+			doc = reparsed;
+		}
+		json_free(old, allocator);
+		for (k = 0; k < depth; k++) {
+			size_t count;
+			JSONValue ** values = container_values(chain[k].container, &count);
+			size_t i;
+			reparse_rebase_span(chain[k].container, old_text, new_text, edit_offset, removed_length, inserted_length);
+			for (i = 0; i < count; i++) {
+				if (REPARSE_MOVES(&chain[k], i, old_text, new_text)) {
+					reparse_rebase(values[i], old_text, new_text, edit_offset, removed_length, inserted_length);
+				}
+			}
+		}
+	}
+done:
+	FREE_ARRAY(&ctx, chain, capacity);
+	ctx_deinit(&ctx);
+	return reparsed ? doc : NULL;
+}
+
+/*
+ * Deep operations.
+ * The parallel variants walk down sequentially until they reach a container
+ * holding at least cutoff values, whose values are then split into tasks
+ * of cutoff values each, which run the sequential operation.
+ * Tasks never job again, so executors don't need to support nested calls.
+ */
+
+static size_t fork_task_count(size_t count, size_t cutoff) {
+	return (count + cutoff - 1) / cutoff;
+}
+
+typedef struct {
+	JSONValue ** values;
+	size_t count;
+	size_t cutoff;
+	JSONAllocator allocator;
+} FreeFork;
+
+static void free_task(void * arg, size_t task) {
+	FreeFork * job = arg;
+	size_t i;
+	size_t end = (task + 1) * job->cutoff < job->count ? (task + 1) * job->cutoff : job->count;
+	for (i = task * job->cutoff; i < end; i++) {
+		json_free(job->values[i], job->allocator);
+	}
+}
+
+void json_free_parallel(JSONValue * value, JSONAllocator allocator, JSONExecutor executor, size_t cutoff) {
+	size_t count;
+	JSONValue ** values = value_children(value, &count);
+	size_t i;
+	if ((allocator.flags & JSON_ALLOCATOR_FREE_NOOP) || !value_drop_ref(value)) {
+		return;
+	}
+	if (cutoff == 0) {
+		cutoff = 1;
+	}
+	if (count >= cutoff) {
+		FreeFork job;
+		job.values = values;
+		job.count = count;
+		job.cutoff = cutoff;
+		job.allocator = allocator;
+		executor.callback(executor.ctx, free_task, &job, fork_task_count(count, cutoff));
+	} else {
+		for (i = 0; i < count; i++) {
+			json_free_parallel(values[i], allocator, executor, cutoff);
+		}
+	}
+	free_shell(value, allocator);
+}
+
+#define HASH_MASK 0xFFFFFFFFUL
+#define HASH_ARRAY_MULTIPLIER 1000003UL
+
+static unsigned long hash_bytes(unsigned long hash, const void * bytes, size_t len) {
+	const unsigned char * c = bytes;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		hash = ((hash ^ c[i]) * 16777619UL) & HASH_MASK;
+	}
+	return hash;
+}
+
+static unsigned long hash_finish(unsigned long hash) {
+	hash ^= hash >> 16;
+	hash = (hash * 0x45D9F3BUL) & HASH_MASK;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+/* the hash of an object member, which are summed so that the order of the keys doesn't matter */
+static unsigned long hash_member(const char * key, unsigned long value_hash) {
+	unsigned long key_hash = hash_bytes(2166136261UL, key, strlen(key));
+	return hash_finish((key_hash * 31 + value_hash) & HASH_MASK);
+}
+
+static unsigned long hash_power(unsigned long base, size_t exponent) {
+	unsigned long result = 1;
+	while (exponent > 0) {
+		if (exponent & 1) {
+			result = (result * base) & HASH_MASK;
+		}
+		base = (base * base) & HASH_MASK;
+		exponent >>= 1;
+	}
+	return result;
+}
+
+#define HASH_SEED_ARRAY 0x2545F491UL
+#define HASH_SEED_OBJECT 0x9E3779B9UL
+
+/*
+ * arrays hash to seed * M^n + sum(hash(values[i]) * M^(n - 1 - i)),
+ * which lets consecutive runs of values be hashed separately and combined
+ */
+static unsigned long hash_array_run(JSONValue * const * values, size_t count) {
+	unsigned long hash = 0;
+	size_t i;
+	for (i = 0; i < count; i++) {
+		hash = (hash * HASH_ARRAY_MULTIPLIER + json_hash(values[i])) & HASH_MASK;
+	}
+	return hash;
+}
+
+static unsigned long hash_object_run(const JSONObject * obj, size_t begin, size_t end) {
+	unsigned long hash = 0;
+	size_t i;
+	for (i = begin; i < end; i++) {
+		hash = (hash + hash_member(obj->shape->keys[i], json_hash(obj->values[i]))) & HASH_MASK;
+	}
+	return hash;
+}
+
+unsigned long json_hash(const JSONValue * value) {
+	const JSONArray * array;
+	const JSONObject * obj;
+	double number;
+	switch (value->type) {
+	case JSON_NULL:
+		return 0x6A09E667UL;
+	case JSON_BOOL:
+		return json_value_as_bool(value) ? 0xBB67AE85UL : 0x3C6EF372UL;
+	case JSON_NUMBER:
+		/* -0.0 == 0.0 so they need the same hash */
+		number = json_value_as_number(value) + 0.0;
+		return hash_finish(hash_bytes(0xA54FF53AUL, &number, sizeof(number)));
+	case JSON_STRING:
+		return hash_finish(hash_bytes(2166136261UL, ((const JSONString *)value)->string, ((const JSONString *)value)->length));
+	case JSON_BINARY:
+		return hash_finish(hash_bytes(0x510E527FUL, ((const JSONBinary *)value)->bytes, ((const JSONBinary *)value)->length));
+	case JSON_RAW:
+		return hash_finish(hash_bytes(0x9B05688CUL, ((const JSONRaw *)value)->text, ((const JSONRaw *)value)->length));
+	case JSON_ARRAY:
+		array = (const JSONArray *)value;
+		return hash_finish((HASH_SEED_ARRAY * hash_power(HASH_ARRAY_MULTIPLIER, array->size) + hash_array_run(array->values, array->size)) & HASH_MASK);
+	case JSON_OBJ:
+		obj = (const JSONObject *)value;
+		return hash_finish((HASH_SEED_OBJECT + hash_object_run(obj, 0, obj->count)) & HASH_MASK);
+	}
+	return 0;
+}
+
+typedef struct {
+	const JSONValue * value;
+	size_t count;
+	size_t cutoff;
+	unsigned long * hashes; /* one per task */
+} HashFork;
+
+static void hash_task(void * arg, size_t task) {
+	HashFork * job = arg;
+	size_t begin = task * job->cutoff;
+	size_t end = begin + job->cutoff < job->count ? begin + job->cutoff : job->count;
+	if (job->value->type == JSON_ARRAY) {
+		job->hashes[task] = hash_array_run(((const JSONArray *)job->value)->values + begin, end - begin);
+	} else {
+		job->hashes[task] = hash_object_run((const JSONObject *)job->value, begin, end);
+	}
+}
+
+unsigned long json_hash_parallel(const JSONValue * value, JSONAllocator allocator, JSONExecutor executor, size_t cutoff) {
+	size_t count;
+	JSONValue ** values = value_children(value, &count);
+	unsigned long hash;
+	size_t tasks;
+	size_t i;
+	HashFork job;
+	if (cutoff == 0) {
+		cutoff = 1;
+	}
+	tasks = fork_task_count(count, cutoff);
+	job.hashes = NULL;
+	if (count >= cutoff) {
+		job.hashes = allocator.callback(allocator.ctx, NULL, 0, tasks * sizeof(*job.hashes));
+	}
+	if (!job.hashes) {
+		if (count >= cutoff) {
+			/* the scratch space couldn't be allocated, which only costs the parallelism */
+			return json_hash(value);
+		}
+		if (value->type == JSON_ARRAY) {
+			hash = 0;
+			for (i = 0; i < count; i++) {
+				hash = (hash * HASH_ARRAY_MULTIPLIER + json_hash_parallel(values[i], allocator, executor, cutoff)) & HASH_MASK;
+			}
+			return hash_finish((HASH_SEED_ARRAY * hash_power(HASH_ARRAY_MULTIPLIER, count) + hash) & HASH_MASK);
+		}
+		if (value->type == JSON_OBJ) {
+			hash = HASH_SEED_OBJECT;
+			for (i = 0; i < count; i++) {
+				hash = (hash + hash_member(((const JSONObject *)value)->shape->keys[i], json_hash_parallel(values[i], allocator, executor, cutoff))) & HASH_MASK;
+			}
+			return hash_finish(hash);
+		}
+		return json_hash(value);
+	}
+	job.value = value;
+	job.count = count;
+	job.cutoff = cutoff;
+	executor.callback(executor.ctx, hash_task, &job, tasks);
+	if (value->type == JSON_ARRAY) {
+		hash = HASH_SEED_ARRAY;
+		for (i = 0; i < tasks; i++) {
+			size_t run = i + 1 < tasks ? cutoff : count - i * cutoff;
+			hash = (hash * hash_power(HASH_ARRAY_MULTIPLIER, run) + job.hashes[i]) & HASH_MASK;
+		}
+	} else {
+		hash = HASH_SEED_OBJECT;
+		for (i = 0; i < tasks; i++) {
+			hash = (hash + job.hashes[i]) & HASH_MASK;
+		}
+	}
+	allocator_free_array(job.hashes, tasks, sizeof(*job.hashes), allocator);
+	return hash_finish(hash);
+}
+
+/*
+ * Objects are equal when they hold the same members as many times each, matching json_hash.
+ * Objects with the same keys in the same order are compared member by member. Otherwise,
+ * or when that fails, which repeated keys can cause in equal objects, the members of both
+ * are sorted by key, so that each run of equal keys lines up with the same run of the other.
+ * A key held once is compared with its partner, and the members of longer runs are counted in both.
+ */
+typedef struct {
+	const char * key;
+	const JSONValue * value;
+} MemberRef;
+
+static int member_ref_compare(const void * a, const void * b) {
+	return strcmp(((const MemberRef *)a)->key, ((const MemberRef *)b)->key);
+}
+
+/* the members of obj sorted by key, allocated with the default allocator, or NULL without memory */
+static MemberRef * sorted_members(const JSONObject * obj) {
+	JSONAllocator allocator = json_default_allocator();
+	MemberRef * refs;
+	size_t i;
+	if (((size_t)-1) / sizeof(MemberRef) < obj->count) {
+		return NULL;
+	}
+	refs = allocator.callback(allocator.ctx, NULL, 0, obj->count * sizeof(MemberRef));
+	if (!refs) {
+		return NULL;
+	}
+	for (i = 0; i < obj->count; i++) {
+		refs[i].key = obj->shape->keys[i];
+		refs[i].value = obj->values[i];
+	}
+	qsort(refs, obj->count, sizeof(MemberRef), member_ref_compare);
+	return refs;
+}
+
+static void free_sorted_members(MemberRef * refs, size_t count) {
+	allocator_free_array(refs, count, sizeof(MemberRef), json_default_allocator());
+}
+
+/* the number of the count members at refs with a value equal to value */
+static size_t count_member(const MemberRef * refs, size_t count, const JSONValue * value) {
+	size_t n = 0;
+	size_t i;
+	for (i = 0; i < count; i++) {
+		n += json_equal(value, refs[i].value);
+	}
+	return n;
+}
+
+/*
+ * compares the sorted members from begin to end, of count in total. Values are compared
+ * with json_equal_parallel when executor isn't NULL. The runs of repeated keys are found
+ * from each of their members, so that the members can be split between tasks anywhere.
+ */
+static int equal_sorted_members(const MemberRef * a, const MemberRef * b, size_t count, size_t begin, size_t end,
+		const JSONExecutor * executor, size_t cutoff) {
+	size_t i;
+	for (i = begin; i < end; i++) {
+		const char * key = a[i].key;
+		size_t low = i;
+		size_t high = i + 1;
+		if (strcmp(key, b[i].key) != 0) {
+			return 0;
+		}
+		while (low > 0 && strcmp(a[low - 1].key, key) == 0) {
+			--low;
+		}
+		while (high < count && strcmp(a[high].key, key) == 0) {
+			++high;
+		}
+		if (high - low == 1) {
+			if (!(executor ? json_equal_parallel(a[i].value, b[i].value, *executor, cutoff) : json_equal(a[i].value, b[i].value))) {
+				return 0;
+			}
+		} else if (count_member(a + low, high - low, a[i].value) != count_member(b + low, high - low, a[i].value)) {
+			/* the keys of every place are compared, by this or another task, so b's run is the same */
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* compares objects with the same number of members whose keys aren't in the same order */
+static int equal_unordered(const JSONObject * a, const JSONObject * b, const JSONExecutor * executor, size_t cutoff) {
+	MemberRef * a_refs = sorted_members(a);
+	MemberRef * b_refs = a_refs ? sorted_members(b) : NULL;
+	int equal = 0;
+	if (b_refs) {
+		equal = equal_sorted_members(a_refs, b_refs, a->count, 0, a->count, executor, cutoff);
+	} else {
+		/* without memory for sorting, each member is counted in both objects */
+		size_t i;
+		equal = 1;
+		for (i = 0; i < a->count && equal; i++) {
+			const char * key = a->shape->keys[i];
+			size_t in_a = 0;
+			size_t in_b = 0;
+			size_t j;
+			for (j = 0; j < a->count; j++) {
+				in_a += strcmp(key, a->shape->keys[j]) == 0 && json_equal(a->values[i], a->values[j]);
+				in_b += strcmp(key, b->shape->keys[j]) == 0 && json_equal(a->values[i], b->values[j]);
+			}
+			equal = in_a == in_b;
+		}
+	}
+	if (a_refs) {
+		free_sorted_members(a_refs, a->count);
+	}
+	if (b_refs) {
+		free_sorted_members(b_refs, b->count);
+	}
+	return equal;
+}
+
+/* whether a and b have the same keys in the same order */
+static int same_keys(const JSONObject * a, const JSONObject * b) {
+	size_t i;
+	if (a->shape == b->shape) {
+		return 1;
+	}
+	if (a->count != b->count) {
+		return 0;
+	}
+	for (i = 0; i < a->count; i++) {
+		if (strcmp(a->shape->keys[i], b->shape->keys[i]) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* compares the members from begin to end in place, knowing both objects have the same keys in the same order */
+static int equal_members(const JSONObject * a, const JSONObject * b, size_t begin, size_t end) {
+	size_t i;
+	for (i = begin; i < end; i++) {
+		if (!json_equal(a->values[i], b->values[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int equal_shallow(const JSONValue * a, const JSONValue * b) {
+	if (a == b) {
+		return 1;
+	}
+	if (a->type != b->type) {
+		return 0;
+	}
+	switch (a->type) {
+	case JSON_NULL:
+		return 1;
+	case JSON_BOOL:
+		return json_value_as_bool(a) == json_value_as_bool(b);
+	case JSON_NUMBER:
+		return json_value_as_number(a) == json_value_as_number(b);
+	case JSON_STRING:
+		return ((const JSONString *)a)->length == ((const JSONString *)b)->length
+			&& memcmp(((const JSONString *)a)->string, ((const JSONString *)b)->string, ((const JSONString *)a)->length) == 0;
+	case JSON_BINARY:
+		return ((const JSONBinary *)a)->length == ((const JSONBinary *)b)->length
+			&& memcmp(((const JSONBinary *)a)->bytes, ((const JSONBinary *)b)->bytes, ((const JSONBinary *)a)->length) == 0;
+	case JSON_RAW:
+		return ((const JSONRaw *)a)->length == ((const JSONRaw *)b)->length
+			&& memcmp(((const JSONRaw *)a)->text, ((const JSONRaw *)b)->text, ((const JSONRaw *)a)->length) == 0;
+	case JSON_ARRAY:
+		return ((const JSONArray *)a)->size == ((const JSONArray *)b)->size;
+	case JSON_OBJ:
+		return ((const JSONObject *)a)->count == ((const JSONObject *)b)->count;
+	}
+	return 0;
+}
+
+int json_equal(const JSONValue * a, const JSONValue * b) {
+	size_t i;
+	if (a == b) {
+		return 1;
+	}
+	if (!equal_shallow(a, b)) {
+		return 0;
+	}
+	switch (a->type) {
+	case JSON_ARRAY:
+		for (i = 0; i < ((const JSONArray *)a)->size; i++) {
+			if (!json_equal(((const JSONArray *)a)->values[i], ((const JSONArray *)b)->values[i])) {
+				return 0;
+			}
+		}
+		return 1;
+	case JSON_OBJ:
+		if (same_keys((const JSONObject *)a, (const JSONObject *)b)
+				&& equal_members((const JSONObject *)a, (const JSONObject *)b, 0, ((const JSONObject *)a)->count)) {
+			return 1;
+		}
+		return equal_unordered((const JSONObject *)a, (const JSONObject *)b, NULL, 0);
+	default:
+		return 1;
+	}
+}
+
+typedef struct {
+	const JSONValue * a;
+	const JSONValue * b;
+	const MemberRef * a_refs; /* the sorted members of objects whose keys aren't in the same order, or NULL */
+	const MemberRef * b_refs;
+	size_t count;
+	size_t cutoff;
+	unsigned long unequal; /* only ever set, by any task that finds a difference */
+} EqualFork;
+
+static void equal_task(void * arg, size_t task) {
+	EqualFork * job = arg;
+	size_t begin = task * job->cutoff;
+	size_t end = begin + job->cutoff < job->count ? begin + job->cutoff : job->count;
+	size_t i;
+	int equal = 1;
+	if (job->a_refs) {
+		equal = equal_sorted_members(job->a_refs, job->b_refs, job->count, begin, end, NULL, 0);
+	} else if (job->a->type == JSON_ARRAY) {
+		for (i = begin; i < end && equal; i++) {
+			equal = json_equal(((const JSONArray *)job->a)->values[i], ((const JSONArray *)job->b)->values[i]);
+		}
+	} else {
+		equal = equal_members((const JSONObject *)job->a, (const JSONObject *)job->b, begin, end);
+	}
+	if (!equal) {
+		ATOMIC_INCREMENT(job->unequal);
+	}
+}
+
+static int equal_fork(EqualFork * job, JSONExecutor executor) {
+	job->unequal = 0;
+	executor.callback(executor.ctx, equal_task, job, fork_task_count(job->count, job->cutoff));
+	return job->unequal == 0;
+}
+
+/* compares large objects whose keys aren't in the same order with sorted members split between tasks */
+static int equal_unordered_fork(EqualFork * job, JSONExecutor executor) {
+	const JSONObject * a = (const JSONObject *)job->a;
+	const JSONObject * b = (const JSONObject *)job->b;
+	MemberRef * a_refs = sorted_members(a);
+	MemberRef * b_refs = a_refs ? sorted_members(b) : NULL;
+	int equal;
+	if (!b_refs) {
+		equal = equal_unordered(a, b, NULL, 0);
+	} else {
+		job->a_refs = a_refs;
+		job->b_refs = b_refs;
+		equal = equal_fork(job, executor);
+	}
+	if (a_refs) {
+		free_sorted_members(a_refs, a->count);
+	}
+	if (b_refs) {
+		free_sorted_members(b_refs, b->count);
+	}
+	return equal;
+}
+
+int json_equal_parallel(const JSONValue * a, const JSONValue * b, JSONExecutor executor, size_t cutoff) {
+	size_t count;
+	JSONValue ** values = value_children(a, &count);
+	JSONValue ** others;
+	size_t i;
+	int ordered = 1;
+	if (cutoff == 0) {
+		cutoff = 1;
+	}
+	if (!equal_shallow(a, b)) {
+		return 0;
+	}
+	if (a == b || count == 0) {
+		return 1;
+	}
+	if (a->type == JSON_OBJ) {
+		ordered = same_keys((const JSONObject *)a, (const JSONObject *)b);
+	}
+	if (count >= cutoff) {
+		EqualFork job;
+		job.a = a;
+		job.b = b;
+		job.a_refs = NULL;
+		job.b_refs = NULL;
+		job.count = count;
+		job.cutoff = cutoff;
+		if (ordered && equal_fork(&job, executor)) {
+			return 1;
+		}
+		return a->type == JSON_OBJ && equal_unordered_fork(&job, executor);
+	}
+	others = value_children(b, &count);
+	for (i = 0; ordered && i < count; i++) {
+		if (!json_equal_parallel(values[i], others[i], executor, cutoff)) {
+			if (a->type == JSON_ARRAY) {
+				return 0;
+			}
+			ordered = 0;
+		}
+	}
+	return ordered || equal_unordered((const JSONObject *)a, (const JSONObject *)b, &executor, cutoff);
+}
+
+void json_visit(const JSONValue * value, JSONVisitor visitor, void * ctx) {
+	size_t count;
+	JSONValue ** values = value_children(value, &count);
+	size_t i;
+	visitor(ctx, value);
+	for (i = 0; i < count; i++) {
+		json_visit(values[i], visitor, ctx);
+	}
+}
+
+typedef struct {
+	JSONValue ** values;
+	size_t count;
+	size_t cutoff;
+	JSONVisitor visitor;
+	void * ctx;
+} VisitFork;
+
+static void visit_task(void * arg, size_t task) {
+	VisitFork * job = arg;
+	size_t i;
+	size_t end = (task + 1) * job->cutoff < job->count ? (task + 1) * job->cutoff : job->count;
+	for (i = task * job->cutoff; i < end; i++) {
+		json_visit(job->values[i], job->visitor, job->ctx);
+	}
+}
+
+void json_visit_parallel(const JSONValue * value, JSONVisitor visitor, void * ctx, JSONExecutor executor, size_t cutoff) {
+	size_t count;
+	JSONValue ** values = value_children(value, &count);
+	size_t i;
+	if (cutoff == 0) {
+		cutoff = 1;
+	}
+	visitor(ctx, value);
+	if (count >= cutoff) {
+		VisitFork job;
+		job.values = values;
+		job.count = count;
+		job.cutoff = cutoff;
+		job.visitor = visitor;
+		job.ctx = ctx;
+		executor.callback(executor.ctx, visit_task, &job, fork_task_count(count, cutoff));
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		json_visit_parallel(values[i], visitor, ctx, executor, cutoff);
+	}
+}
+
+/*
+ * Clones share the shapes of the original when they are made with the allocator that owns them.
+ * Otherwise each shape is copied once per clone (or per task), remembering
+ * the copies in a table so that the clones keep sharing them.
+ */
+typedef struct {
+	JSONAllocator allocator;
+	JSONShape ** originals; /* open addressed, keyed by pointer */
+	JSONShape ** copies;
+	size_t capacity;
+	size_t count;
+} Cloner;
+
+static void cloner_init(Cloner * cloner, JSONAllocator allocator) {
+	cloner->allocator = allocator;
+	cloner->originals = NULL;
+	cloner->copies = NULL;
+	cloner->capacity = 0;
+	cloner->count = 0;
+}
+
+static void cloner_deinit(Cloner * cloner) {
+	allocator_free_array(cloner->originals, cloner->capacity, sizeof(*cloner->originals), cloner->allocator);
+	allocator_free_array(cloner->copies, cloner->capacity, sizeof(*cloner->copies), cloner->allocator);
+}
+
+static size_t pointer_hash(const void * pointer) {
+	size_t bits = (size_t)pointer;
+	return (bits >> 4) ^ (bits >> 12);
+}
+
+static int allocator_equal(JSONAllocator a, JSONAllocator b) {
+	return a.ctx == b.ctx && a.callback == b.callback;
+}
+
+static JSONShape * shape_copy(JSONShape * shape, JSONAllocator allocator) {
+	JSONShape * copy = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONShape));
+	size_t i;
+	if (!copy) {
+		return NULL;
+	}
+	*copy = *shape;
+	copy->refs = 1;
+	copy->hint = 0;
+	copy->allocator = allocator;
+	copy->keys = NULL;
+	if (shape->count == 0) {
+		return copy;
+	}
+	copy->keys = allocator.callback(allocator.ctx, NULL, 0, shape->count * sizeof(*copy->keys));
+	if (!copy->keys) {
+		allocator_free(copy, sizeof(JSONShape), allocator);
+		return NULL;
+	}
+	for (i = 0; i < shape->count; i++) {
+		size_t len = strlen(shape->keys[i]) + 1;
+		copy->keys[i] = allocator.callback(allocator.ctx, NULL, 0, len);
+		if (!copy->keys[i]) {
+			copy->count = i;
+			shape_release(copy);
+			return NULL;
+		}
+		memcpy(copy->keys[i], shape->keys[i], len);
+	}
+	return copy;
+}
+
+static JSONShape * cloner_shape(Cloner * cloner, JSONShape * shape) {
+	size_t i;
+	size_t mask;
+	JSONShape * copy;
+	if (allocator_equal(shape->allocator, cloner->allocator)) {
+		ATOMIC_INCREMENT(shape->refs);
+		return shape;
+	}
+	mask = cloner->capacity - 1;
+	if (cloner->capacity > 0) {
+		for (i = pointer_hash(shape) & mask; cloner->originals[i]; i = (i + 1) & mask) {
+			if (cloner->originals[i] == shape) {
+				++cloner->copies[i]->refs;
+				return cloner->copies[i];
+			}
+		}
+	}
+	copy = shape_copy(shape, cloner->allocator);
+	if (!copy) {
+		return NULL;
+	}
+	if ((cloner->count + 1) * 2 > cloner->capacity) {
+		/* the table only makes clones share shapes, so it is fine for it not to grow */
+		size_t capacity = cloner->capacity ? cloner->capacity * 2 : 16;
+		JSONAllocator allocator = cloner->allocator;
+		JSONShape ** originals = allocator.callback(allocator.ctx, NULL, 0, capacity * sizeof(*originals));
+		JSONShape ** copies = originals ? allocator.callback(allocator.ctx, NULL, 0, capacity * sizeof(*copies)) : NULL;
+		if (!copies) {
+			allocator_free_array(originals, capacity, sizeof(*originals), allocator);
+			return copy;
+		}
+		for (i = 0; i < capacity; i++) {
+			originals[i] = NULL;
+		}
+		for (i = 0; i < cloner->capacity; i++) {
+			size_t j;
+			if (!cloner->originals[i]) {
+				continue;
+			}
+			for (j = pointer_hash(cloner->originals[i]) & (capacity - 1); originals[j]; j = (j + 1) & (capacity - 1));
+			originals[j] = cloner->originals[i];
+			copies[j] = cloner->copies[i];
+		}
+		cloner_deinit(cloner);
+		cloner->originals = originals;
+		cloner->copies = copies;
+		cloner->capacity = capacity;
+		mask = capacity - 1;
+	}
+	for (i = pointer_hash(shape) & mask; cloner->originals[i]; i = (i + 1) & mask);
+	cloner->originals[i] = shape;
+	cloner->copies[i] = copy;
+	++cloner->count;
+	return copy;
+}
+
+/* copies value without the values it holds, leaving room for them */
+static JSONValue * clone_shell(Cloner * cloner, const JSONValue * value) {
+	JSONAllocator allocator = cloner->allocator;
+	size_t count;
+	JSONValue ** values = NULL;
+	JSONValue * clone;
+	value_children(value, &count);
+	switch (value->type) {
+	case JSON_NULL:
+	case JSON_BOOL:
+		return (JSONValue *)value;
+	case JSON_NUMBER:
+		clone = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONNumber));
+		if (clone) {
+			*(JSONNumber *)clone = *(const JSONNumber *)value;
+			clone->refs = 1;
+			clone->flags = 0;
+		}
+		return clone;
+	case JSON_STRING: {
+		const JSONString * string = (const JSONString *)value;
+		JSONString * copy = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONString));
+		if (!copy) {
+			return NULL;
+		}
+		*copy = *string;
+		copy->value.refs = 1;
+		copy->value.flags = 0;
+		copy->string = allocator.callback(allocator.ctx, NULL, 0, string->length + 1);
+		if (!copy->string) {
+			allocator_free(copy, sizeof(JSONString), allocator);
+			return NULL;
+		}
+		memcpy(copy->string, string->string, string->length + 1);
+		return (JSONValue *)copy;
+	}
+	case JSON_BINARY: {
+		const JSONBinary * binary = (const JSONBinary *)value;
+		JSONBinary * copy = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONBinary));
+		if (!copy) {
+			return NULL;
+		}
+		*copy = *binary;
+		copy->value.refs = 1;
+		copy->value.flags = 0;
+		if (binary->length > 0) {
+			copy->bytes = allocator.callback(allocator.ctx, NULL, 0, binary->length);
+			if (!copy->bytes) {
+				allocator_free(copy, sizeof(JSONBinary), allocator);
+				return NULL;
+			}
+			memcpy(copy->bytes, binary->bytes, binary->length);
+		}
+		return (JSONValue *)copy;
+	}
+	case JSON_RAW:
+		return json_new_raw(((const JSONRaw *)value)->text, ((const JSONRaw *)value)->length, allocator);
+	case JSON_ARRAY:
+	case JSON_OBJ:
+		break;
+	}
+	if (count > 0) {
+		size_t i;
+		if (((size_t)-1) / count < sizeof(*values)) {
+			return NULL;
+		}
+		values = allocator.callback(allocator.ctx, NULL, 0, count * sizeof(*values));
+		if (!values) {
+			return NULL;
+		}
+		/* the shell may be freed before all of its values are cloned */
+		for (i = 0; i < count; i++) {
+			values[i] = &json_null;
+		}
+	}
+	if (value->type == JSON_ARRAY) {
+		JSONArray * array = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONArray));
+		if (!array) {
+			allocator_free_array(values, count, sizeof(*values), allocator);
+			return NULL;
+		}
+		array->value.type = JSON_ARRAY;
+		array->value.refs = 1;
+		array->value.flags = 0;
+		array->values = values;
+		array->size = count;
+		return (JSONValue *)array;
+	} else {
+		JSONObject * obj = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONObject));
+		JSONShape * shape = obj ? cloner_shape(cloner, ((const JSONObject *)value)->shape) : NULL;
+		if (!shape) {
+			allocator_free(obj, sizeof(JSONObject), allocator);
+			allocator_free_array(values, count, sizeof(*values), allocator);
+			return NULL;
+		}
+		obj->value.type = JSON_OBJ;
+		obj->value.refs = 1;
+		obj->value.flags = 0;
+		obj->shape = shape;
+		obj->values = values;
+		obj->count = count;
+		return (JSONValue *)obj;
+	}
+}
+
+static JSONValue * clone_value(Cloner * cloner, const JSONValue * value) {
+	size_t count;
+	JSONValue ** values = value_children(value, &count);
+	JSONValue * clone = clone_shell(cloner, value);
+	JSONValue ** clone_values;
+	size_t i;
+	if (!clone) {
+		return NULL;
+	}
+	clone_values = value_children(clone, &count);
+	for (i = 0; i < count; i++) {
+		JSONValue * child = clone_value(cloner, values[i]);
+		if (!child) {
+			json_free(clone, cloner->allocator);
+			return NULL;
+		}
+		clone_values[i] = child;
+	}
+	return clone;
+}
+
+JSONValue * json_clone(const JSONValue * value, JSONAllocator allocator) {
+	Cloner cloner;
+	JSONValue * clone;
+	cloner_init(&cloner, allocator);
+	clone = clone_value(&cloner, value);
+	cloner_deinit(&cloner);
+	return clone;
+}
+
+typedef struct {
+	JSONValue ** values;
+	JSONValue ** clone_values;
+	size_t count;
+	size_t cutoff;
+	JSONAllocator allocator;
+	unsigned long failed; /* only ever set, by any task that runs out of memory */
+} CloneFork;
+
+static void clone_task(void * arg, size_t task) {
+	CloneFork * job = arg;
+	size_t i;
+	size_t end = (task + 1) * job->cutoff < job->count ? (task + 1) * job->cutoff : job->count;
+	Cloner cloner;
+	cloner_init(&cloner, job->allocator);
+	for (i = task * job->cutoff; i < end; i++) {
+		JSONValue * child = clone_value(&cloner, job->values[i]);
+		if (!child) {
+			ATOMIC_INCREMENT(job->failed);
+			break;
+		}
+		job->clone_values[i] = child;
+	}
+	cloner_deinit(&cloner);
+}
+
+static JSONValue * clone_parallel(Cloner * cloner, const JSONValue * value, JSONExecutor executor, size_t cutoff) {
+	size_t count;
+	JSONValue ** values = value_children(value, &count);
+	JSONValue * clone = clone_shell(cloner, value);
+	JSONValue ** clone_values;
+	size_t i;
+	if (!clone) {
+		return NULL;
+	}
+	clone_values = value_children(clone, &count);
+	if (count >= cutoff) {
+		CloneFork job;
+		job.values = values;
+		job.clone_values = clone_values;
+		job.count = count;
+		job.cutoff = cutoff;
+		job.allocator = cloner->allocator;
+		job.failed = 0;
+		executor.callback(executor.ctx, clone_task, &job, fork_task_count(count, cutoff));
+		if (job.failed) {
+			json_free(clone, cloner->allocator);
+			return NULL;
+		}
+		return clone;
+	}
+	for (i = 0; i < count; i++) {
+		JSONValue * child = clone_parallel(cloner, values[i], executor, cutoff);
+		if (!child) {
+			json_free(clone, cloner->allocator);
+			return NULL;
+		}
+		clone_values[i] = child;
+	}
+	return clone;
+}
+
+JSONValue * json_clone_parallel(const JSONValue * value, JSONAllocator allocator, JSONExecutor executor, size_t cutoff) {
+	Cloner cloner;
+	JSONValue * clone;
+	if (cutoff == 0) {
+		cutoff = 1;
+	}
+	cloner_init(&cloner, allocator);
+	clone = clone_parallel(&cloner, value, executor, cutoff);
+	cloner_deinit(&cloner);
+	return clone;
+}
+
+
+
+/*
+ * Hash-consing.
+ * The deduper keeps one canonical value for each distinct value it is given,
+ * which identical values are then replaced with. Values are given to it after
+ * the values they hold, which are therefore canonical already, so that
+ * containers are hashed and compared by the pointers to their values, without recursing.
+ * Values with a count of 0 are never made canonical, since some of them are only borrowed.
+ */
+
+static void deduper_init(Deduper * deduper, JSONAllocator allocator) {
+	deduper->allocator = allocator;
+	deduper->values = NULL;
+	deduper->hashes = NULL;
+	deduper->capacity = 0;
+	deduper->count = 0;
+}
+
+/* forgets the canonical values while keeping the table, for the next document */
+static void deduper_forget(Deduper * deduper) {
+	size_t i;
+	if (deduper->count == 0) {
+		return;
+	}
+	for (i = 0; i < deduper->capacity; i++) {
+		deduper->values[i] = NULL;
+	}
+	deduper->count = 0;
+}
+
+static void deduper_deinit(Deduper * deduper) {
+	allocator_free_array(deduper->values, deduper->capacity, sizeof(*deduper->values), deduper->allocator);
+	allocator_free_array(deduper->hashes, deduper->capacity, sizeof(*deduper->hashes), deduper->allocator);
+}
+
+/*
+ * Values that print their source text, as with retain_spans, are only identical when that
+ * text is too, or else 1.0 and 1e0 would both print as whichever came first.
+ */
+static unsigned long dedup_hash(const JSONValue * value) {
+	unsigned long hash = hash_bytes(2166136261UL, &value->type, sizeof(value->type));
+	size_t count;
+	JSONValue ** values = value_children(value, &count);
+	size_t i;
+	if (value_is_clean(value)) {
+		const SourceSpan * span = value_span(value);
+		hash = hash_bytes(hash, span->begin, span->length);
+	}
+	switch (value->type) {
+	case JSON_NUMBER:
+		return hash_bytes(hash, &((const JSONNumber *)value)->number, sizeof(double));
+	case JSON_STRING:
+		return hash_bytes(hash, ((const JSONString *)value)->string, ((const JSONString *)value)->length);
+	case JSON_BINARY:
+		return hash_bytes(hash, ((const JSONBinary *)value)->bytes, ((const JSONBinary *)value)->length);
+	case JSON_RAW:
+		return hash_bytes(hash, ((const JSONRaw *)value)->text, ((const JSONRaw *)value)->length);
+	case JSON_OBJ:
+		for (i = 0; i < count; i++) {
+			const char * key = ((const JSONObject *)value)->shape->keys[i];
+			hash = hash_bytes(hash, key, strlen(key) + 1);
+		}
+		break;
+	default:
+		break;
+	}
+	for (i = 0; i < count; i++) {
+		hash = hash_bytes(hash, &values[i], sizeof(values[i]));
+	}
+	return hash;
+}
+
+static int dedup_equal(const JSONValue * a, const JSONValue * b) {
+	size_t a_count;
+	size_t b_count;
+	JSONValue ** a_values = value_children(a, &a_count);
+	JSONValue ** b_values = value_children(b, &b_count);
+	size_t i;
+	if (a->type != b->type || value_is_clean(a) != value_is_clean(b)) {
+		return 0;
+	}
+	if (value_is_clean(a)) {
+		const SourceSpan * a_span = value_span(a);
+		const SourceSpan * b_span = value_span(b);
+		if (a_span->length != b_span->length || memcmp(a_span->begin, b_span->begin, a_span->length) != 0) {
+			return 0;
+		}
+	}
+	switch (a->type) {
+	case JSON_NUMBER:
+		/* compared bitwise, so that 0 and -0 stay apart */
+		return memcmp(&((const JSONNumber *)a)->number, &((const JSONNumber *)b)->number, sizeof(double)) == 0;
+	case JSON_STRING: {
+		const JSONString * as = (const JSONString *)a;
+		const JSONString * bs = (const JSONString *)b;
+		return as->length == bs->length && memcmp(as->string, bs->string, as->length) == 0;
+	}
+	case JSON_BINARY: {
+		const JSONBinary * ab = (const JSONBinary *)a;
+		const JSONBinary * bb = (const JSONBinary *)b;
+		return ab->length == bb->length && memcmp(ab->bytes, bb->bytes, ab->length) == 0;
+	}
+	case JSON_RAW: {
+		const JSONRaw * ar = (const JSONRaw *)a;
+		const JSONRaw * br = (const JSONRaw *)b;
+		return ar->length == br->length && memcmp(ar->text, br->text, ar->length) == 0;
+	}
+	case JSON_OBJ: {
+		const JSONShape * as = ((const JSONObject *)a)->shape;
+		const JSONShape * bs = ((const JSONObject *)b)->shape;
+		if (a_count != b_count) {
+			return 0;
+		}
+		if (as != bs) {
+			for (i = 0; i < a_count; i++) {
+				if (strcmp(as->keys[i], bs->keys[i]) != 0) {
+					return 0;
+				}
+			}
+		}
+		break;
+	}
+	case JSON_ARRAY:
+		if (a_count != b_count) {
+			return 0;
+		}
+		break;
+	default:
+		return a == b;
+	}
+	for (i = 0; i < a_count; i++) {
+		if (a_values[i] != b_values[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* the table is only a cache, so failing to grow it just means later values won't be shared */
+static int deduper_grow(Deduper * deduper) {
+	JSONAllocator allocator = deduper->allocator;
+	size_t capacity = deduper->capacity ? deduper->capacity * 2 : 64;
+	JSONValue ** values = allocator.callback(allocator.ctx, NULL, 0, capacity * sizeof(*values));
+	unsigned long * hashes = values ? allocator.callback(allocator.ctx, NULL, 0, capacity * sizeof(*hashes)) : NULL;
+	size_t i;
+	if (!hashes) {
+		allocator_free_array(values, capacity, sizeof(*values), allocator);
+		return 0;
+	}
+	for (i = 0; i < capacity; i++) {
+		values[i] = NULL;
+	}
+	for (i = 0; i < deduper->capacity; i++) {
+		size_t j;
+		if (!deduper->values[i]) {
+			continue;
+		}
+		for (j = deduper->hashes[i] & (capacity - 1); values[j]; j = (j + 1) & (capacity - 1));
+		values[j] = deduper->values[i];
+		hashes[j] = deduper->hashes[i];
+	}
+	deduper_deinit(deduper);
+	deduper->values = values;
+	deduper->hashes = hashes;
+	deduper->capacity = capacity;
+	return 1;
+}
+
+/* finds the slot of the value identical to value, or the empty slot where it belongs */
+static size_t deduper_find(const Deduper * deduper, const JSONValue * value, unsigned long hash) {
+	size_t mask = deduper->capacity - 1;
+	size_t i;
+	for (i = hash & mask; deduper->values[i]; i = (i + 1) & mask) {
+		if (deduper->hashes[i] == hash && dedup_equal(deduper->values[i], value)) {
+			break;
+		}
+	}
+	return i;
+}
+
+/* takes over the reference to value, returning a reference to its canonical value */
+static JSONValue * deduper_intern(Deduper * deduper, JSONValue * value) {
+	unsigned long hash;
+	size_t i;
+	if (value->refs == 0) {
+		return value;
+	}
+	hash = dedup_hash(value);
+	if (deduper->capacity > 0) {
+		i = deduper_find(deduper, value, hash);
+		if (deduper->values[i]) {
+			JSONValue * canonical = deduper->values[i];
+			if (canonical != value) {
+				json_retain(canonical);
+				json_free(value, deduper->allocator);
+			}
+			return canonical;
+		}
+	}
+	if ((deduper->count + 1) * 2 > deduper->capacity && !deduper_grow(deduper)) {
+		return value;
+	}
+	i = deduper_find(deduper, value, hash);
+	deduper->values[i] = value;
+	deduper->hashes[i] = hash;
+	++deduper->count;
+	return value;
+}
+
+static JSONValue * dedup_value(Deduper * deduper, JSONValue * value) {
+	size_t count;
+	JSONValue ** values = value_children(value, &count);
+	size_t i;
+	/* shared containers may be reached again, after they were made canonical */
+	if (value->refs > 1 && count > 0 && deduper->capacity > 0) {
+		i = deduper_find(deduper, value, dedup_hash(value));
+		if (deduper->values[i] == value) {
+			return value;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		values[i] = dedup_value(deduper, values[i]);
+	}
+	return deduper_intern(deduper, value);
+}
+
+JSONValue * json_dedup(JSONValue * value, JSONAllocator allocator) {
+	Deduper deduper;
+	deduper_init(&deduper, allocator);
+	value = dedup_value(&deduper, value);
+	deduper_deinit(&deduper);
+	return value;
+}
+
+/*
+ * The reclaimer is a lock free stack of values waiting to be freed,
+ * which any thread may push to while one thread drains it.
+ */
+struct JSONReclaimNode {
+	JSONReclaimNode * next;
+	JSONValue * value;
+	JSONAllocator allocator;
+};
+
+void json_reclaimer_init(JSONReclaimer * reclaimer) {
+	reclaimer->head = NULL;
+	reclaimer->pending = NULL;
+}
+
+static void reclaimer_push(JSONReclaimer * reclaimer, JSONReclaimNode * node) {
+	JSONReclaimNode * head;
+	do {
+		head = reclaimer->head;
+		node->next = head;
+	} while (!ATOMIC_COMPARE_SWAP(reclaimer->head, head, node));
+}
+
+void json_free_async(JSONReclaimer * reclaimer, JSONValue * value, JSONAllocator allocator) {
+	JSONReclaimNode * node = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONReclaimNode));
+	if (!node) {
+		/* there is no memory to defer it with, so it is better freed now */
+		json_free(value, allocator);
+		return;
+	}
+	node->value = value;
+	node->allocator = allocator;
+	reclaimer_push(reclaimer, node);
+}
+
+/*
+ * Values left over by a partial drain stay on the pending list, which only the
+ * draining thread touches, so the next drain carries on from there in constant time.
+ * The shared stack is taken at most once per drain, after the pending values are gone.
+ */
+size_t json_reclaimer_drain(JSONReclaimer * reclaimer, size_t max_values) {
+	size_t freed = 0;
+	int taken = 0;
+	while (max_values == 0 || freed < max_values) {
+		JSONReclaimNode * node = reclaimer->pending;
+		JSONAllocator allocator;
+		if (!node) {
+			if (taken) {
+				break;
+			}
+			node = ATOMIC_EXCHANGE(reclaimer->head, NULL);
+			taken = 1;
+			if (!node) {
+				break;
+			}
+		}
+		reclaimer->pending = node->next;
+		allocator = node->allocator;
+		json_free(node->value, allocator);
+		allocator_free(node, sizeof(JSONReclaimNode), allocator);
+		++freed;
+	}
+	return freed;
+}
+
+JSONType json_value_type(const JSONValue * value) {
+	return (JSONType)value->type;
+}
+
+int json_value_as_bool(const JSONValue * value) {
+	return value == &json_true;
+}
+
+double json_value_as_number(const JSONValue * value) {
+	return ((JSONNumber *)value)->number;
+}
+
+const char * json_value_as_string(const JSONValue * value) {
+	return ((JSONString *)value)->string;
+}
+
+const unsigned char * json_value_as_binary(const JSONValue * value, size_t * length) {
+	const JSONBinary * binary = (const JSONBinary *)value;
+	*length = binary->length;
+	return binary->bytes;
+}
+
+const char * json_value_as_raw(const JSONValue * value, size_t * length) {
+	const JSONRaw * raw = (const JSONRaw *)value;
+	*length = raw->length;
+	return raw->text;
+}
+
+int json_value_decode_base64(const JSONValue * value, void * out, size_t * len) {
+	const char * text;
+	size_t text_len;
+	size_t size;
+	if (value->type == JSON_BINARY) {
+		const JSONBinary * binary = (const JSONBinary *)value;
+		if (out) {
+			if (*len < binary->length) {
+				return 0;
+			}
+			memcpy(out, binary->bytes, binary->length);
+		}
+		*len = binary->length;
+		return 1;
+	}
+	if (value->type != JSON_STRING) {
+		return 0;
+	}
+	text = ((const JSONString *)value)->string;
+	text_len = ((const JSONString *)value)->length;
+	size = base64_decoded_size(text, text_len);
+	if (size == (size_t)-1) {
+		return 0;
+	}
+	if (!out && !base64_valid(text, text_len)) {
+		return 0;
+	}
+	if (out) {
+		if (*len < size || !base64_decode(text, text_len, out)) {
+			return 0;
+		}
+	}
+	*len = size;
+	return 1;
+}
+
+const JSONArray * json_value_as_array(const JSONValue * value) {
+	return (JSONArray *)value;
+}
+
+const JSONObject * json_value_as_object(const JSONValue * value) {
+	return (JSONObject *)value;
+}
+
+const JSONValue * json_array_as_value(const JSONArray * array) {
+	return (JSONValue *)array;
+}
+
+const JSONValue * json_object_as_value(const JSONObject * obj) {
+	return (JSONValue *)obj;
+}
+
+const JSONValue * json_array_index(const JSONArray * array, size_t index) {
+	return array->values[index];
+}
+
+const JSONValue * json_object_index(const JSONObject * obj, size_t index) {
+	return obj->values[index];
+}
+
+const char * json_object_index_keys(const JSONObject * obj, size_t index) {
+	return obj->shape->keys[index];
+}
+
+const JSONValue * json_object_get(const JSONObject * obj, const char * key) {
+	JSONShape * shape = obj->shape;
+	size_t i = ATOMIC_LOAD_RELAXED(shape->hint);
+	if (i < obj->count && strcmp(key, shape->keys[i]) == 0) {
+		return obj->values[i];
+	}
+	for (i = 0; i < obj->count; i++) {
+		if (strcmp(key, shape->keys[i]) == 0) {
+			ATOMIC_STORE_RELAXED(shape->hint, i);
+			return obj->values[i];
+		}
+	}
+	return NULL;
+}
+
+size_t json_array_length(const JSONArray * array) {
+	return array->size;
+}
+
+size_t json_object_count(const JSONObject * obj) {
+	return obj->count;
+}
+
+static void print_indent(FILE * file, size_t indent) {
+	size_t i;
+	for (i = 0; i < indent; i++) {
+		fputs("  ", file);
+	}
+}
+
+static void print_value(FILE * file, const JSONValue * value, size_t indent);
+
+static void print_string(FILE * file, const char * str) {
+	char c;
+	fputc('\"', file);
+	for (c = *str; c != '\0'; ++str, c = *str) {
+		switch (c) {
+			case '\b':
+				c = 'b';
+				break;
+			case '\f':
+				c = 'f';
+				break;
+			case '\n':
+				c = 'n';
+				break;
+			case '\r':
+				c = 'r';
+				break;
+			case '\"':
+				c = '\"';
+				break;
+			case '\\':
+				c = '\\';
+				break;
+			default:
+				goto end;
+		}
+		fputc('\\', file);
+end:;
+		fputc(c, file);
+	}
+	fputc('\"', file);
+}
+
+static void print_base64(FILE * file, const JSONValue * value) {
+	const unsigned char * bytes = ((const JSONBinary *)value)->bytes;
+	size_t length = ((const JSONBinary *)value)->length;
+	size_t i;
+	fputc('\"', file);
+	for (i = 0; i + 2 < length; i += 3) {
+		unsigned long bits = (unsigned long)bytes[i] << 16 | (unsigned long)bytes[i + 1] << 8 | bytes[i + 2];
+		fputc(base64_digits[(bits >> 18) & 0x3F], file);
+		fputc(base64_digits[(bits >> 12) & 0x3F], file);
+		fputc(base64_digits[(bits >> 6) & 0x3F], file);
+		fputc(base64_digits[bits & 0x3F], file);
+	}
+	if (i < length) {
+		unsigned long bits = (unsigned long)bytes[i] << 16 | (i + 1 < length ? (unsigned long)bytes[i + 1] << 8 : 0);
+		fputc(base64_digits[(bits >> 18) & 0x3F], file);
+		fputc(base64_digits[(bits >> 12) & 0x3F], file);
+		fputc(i + 1 < length ? base64_digits[(bits >> 6) & 0x3F] : '=', file);
+		fputc('=', file);
+	}
+	fputc('\"', file);
+}
+
+static void print_obj(FILE * file, const JSONObject * obj, size_t indent) {
+	fputs("{", file);
+	if (obj->count > 0) {
+		size_t i = 0;
+		for (;;) {
+			char * str;
+			fputc('\n', file);
+			print_indent(file, indent + 1);
+			str = obj->shape->keys[i];
+			print_string(file, str);
+			fputs(": ", file);
+			print_value(file, obj->values[i], indent + 1);
+			++i;
+			if (i == obj->count) {
+				break;
+			}
+			fputs(",", file);
+		}
+		fputc('\n', file);
+		print_indent(file, indent - 1);
+	}
+	fputc('}', file);
+}
+
+static void print_array(FILE * file, const JSONArray * array, size_t indent) {
+	fputs("[", file);
+	if (array->size > 0) {
+		size_t i;
+		for (i = 0;;) {
+			fputc('\n', file);
+			print_indent(file, indent + 1);
+			print_value(file, array->values[i], indent + 1);
+			++i;
+			if (i == array->size) {
+				break;
+			}
+			fputs(",", file);
+		}
+		fputc('\n', file);
+		print_indent(file, indent - 1);
+	}
+	fputc(']', file);
+}
+
+/* writes the source text of a value that hasn't changed since it was parsed */
+static int print_span(FILE * file, const JSONValue * value) {
+	const SourceSpan * span;
+	if (!value_is_clean(value)) {
+		return 0;
+	}
+	span = value_span(value);
+	fwrite(span->begin, 1, span->length, file);
+	return 1;
+}
+
+static void print_value(FILE * file, const JSONValue * value, size_t indent) {
+	/* only scalars, as the text of containers isn't laid out the same */
+	if (value->type != JSON_ARRAY && value->type != JSON_OBJ && print_span(file, value)) {
+		return;
+	}
+	switch (value->type) {
+	case JSON_NULL:
+		fputs("null", file);
+		break;
+	case JSON_BOOL:
+		fputs(json_value_as_bool(value) ? "true" : "false", file);
+		break;
+	case JSON_NUMBER:
+		fprintf(file, "%.17g", json_value_as_number(value));
+		break;
+	case JSON_STRING:
+		print_string(file, json_value_as_string(value));
+		break;
+	case JSON_BINARY:
+		print_base64(file, value);
+		break;
+	case JSON_RAW:
+		fwrite(((const JSONRaw *)value)->text, 1, ((const JSONRaw *)value)->length, file);
+		break;
+	case JSON_ARRAY:
+		print_array(file, json_value_as_array(value), indent + 1);
+		break;
+	case JSON_OBJ:
+		print_obj(file, json_value_as_object(value), indent + 1);
+		break;
+	}
+}
+
+int json_print(FILE * file, const JSONValue * value) {
+	print_value(file, value, 0);
+	putc('\n', file);
+	return ferror(file);
+}
+
+static void print_value_min(FILE * file, const JSONValue * value, int preserve) {
+	char * sep;
+	const JSONArray * array;
+	const JSONObject * object;
+	size_t i;
+	if ((preserve || (value->type != JSON_ARRAY && value->type != JSON_OBJ)) && print_span(file, value)) {
+		return;
+	}
+	switch (value->type) {
+	case JSON_NULL:
+		fputs("null", file);
+		break;
+	case JSON_BOOL:
+		fputs(json_value_as_bool(value) ? "true" : "false", file);
+		break;
+	case JSON_NUMBER:
+		fprintf(file, "%.17g", json_value_as_number(value));
+		break;
+	case JSON_STRING:
+		print_string(file, json_value_as_string(value));
+		break;
+	case JSON_BINARY:
+		print_base64(file, value);
+		break;
+	case JSON_RAW:
+		fwrite(((const JSONRaw *)value)->text, 1, ((const JSONRaw *)value)->length, file);
+		break;
+	case JSON_ARRAY:
+		fputc('[', file);
+		sep = "";
+		array = json_value_as_array(value);
+		for (i = 0; i < array->size; i++) {
+			fputs(sep, file);
+			print_value_min(file, array->values[i], preserve);
+			sep = ",";
+		}
+		fputc(']', file);
+		break;
+	case JSON_OBJ:
+		fputc('{', file);
+		sep  = "";
+		object = json_value_as_object(value);
+		for ( i = 0; i < object->count; i++) {
+			fputs(sep, file);
+			print_string(file, object->shape->keys[i]);
+			fputc(':', file);
+			print_value_min(file, object->values[i], preserve);
+			sep  = ",";
+		}
+		fputc('}', file);
+		break;
+	}
+}
+
+int json_print_minified(FILE * file, const JSONValue * value) {
+	print_value_min(file, value, 0);
+	return ferror(file);
+}
+
+int json_print_preserving(FILE * file, const JSONValue * value) {
+	print_value_min(file, value, 1);
+	return ferror(file);
+}
+
+/*
+ * NDJSON column extraction walks each record with the scanner,
+ * only descending into the objects that lie on one of the requested paths,
+ * and writes the values it finds straight into the column buffers.
+ */
+typedef struct {
+	Ctx ctx;
+	JSONColumn * columns;
+	const char * const * paths;
+	size_t nfields;
+	size_t depth; /* the number of segments in the longest path */
+	unsigned char * active; /* nfields flags per path depth */
+	size_t row;
+} Extractor;
+
+static size_t column_element_size(JSONColumnType type) {
+	switch (type) {
+	case JSON_COLUMN_NUMBER:
+		return sizeof(double);
+	case JSON_COLUMN_INTEGER:
+		return sizeof(long);
+	case JSON_COLUMN_STRING:
+		break;
+	}
+	return sizeof(size_t);
+}
+
+/* the data array of string columns has an extra slot for the end offset of the last row */
+static size_t column_data_count(const JSONColumn * column, size_t capacity) {
+	return column->type == JSON_COLUMN_STRING ? capacity + 1 : capacity;
+}
+
+static void * column_data(JSONColumn * column) {
+	switch (column->type) {
+	case JSON_COLUMN_NUMBER:
+		return column->numbers;
+	case JSON_COLUMN_INTEGER:
+		return column->integers;
+	case JSON_COLUMN_STRING:
+		break;
+	}
+	return column->offsets;
+}
+
+static void column_set_data(JSONColumn * column, void * data) {
+	switch (column->type) {
+	case JSON_COLUMN_NUMBER:
+		column->numbers = data;
+		break;
+	case JSON_COLUMN_INTEGER:
+		column->integers = data;
+		break;
+	case JSON_COLUMN_STRING:
+		column->offsets = data;
+		break;
+	}
+}
+
+static int column_reserve(Ctx * ctx, JSONColumn * column, size_t rows) {
+	size_t capacity = column->capacity ? column->capacity : 64;
+	size_t element_size = column_element_size(column->type);
+	unsigned char * validity;
+	void * data;
+	if (rows <= column->capacity) {
+		return 1;
+	}
+	while (capacity < rows) {
+		capacity *= 2;
+	}
+	/* the old buffers are kept until both new ones exist, so a failure leaves the column as it was */
+	validity = ctx_grow_array(ctx, NULL, 0, (capacity + 7) / 8, 1);
+	if (!validity) {
+		return 0;
+	}
+	data = ctx_grow_array(ctx, NULL, 0, column_data_count(column, capacity), element_size);
+	if (!data) {
+		allocator_free(validity, (capacity + 7) / 8, ctx->allocator);
+		return 0;
+	}
+	if (column->capacity > 0) {
+		memcpy(validity, column->validity, (column->capacity + 7) / 8);
+		memcpy(data, column_data(column), column_data_count(column, column->capacity) * element_size);
+		allocator_free(column->validity, (column->capacity + 7) / 8, ctx->allocator);
+		allocator_free_array(column_data(column), column_data_count(column, column->capacity), element_size, ctx->allocator);
+	} else if (column->type == JSON_COLUMN_STRING) {
+		((size_t *)data)[0] = 0;
+	}
+	column->validity = validity;
+	column_set_data(column, data);
+	column->capacity = capacity;
+	return 1;
+}
+
+static int column_push_row(Ctx * ctx, JSONColumn * column) {
+	size_t row = column->rows;
+	if (!column_reserve(ctx, column, row + 1)) {
+		return 0;
+	}
+	column->validity[row / 8] &= ~(1 << (row % 8));
+	switch (column->type) {
+	case JSON_COLUMN_NUMBER:
+		column->numbers[row] = 0;
+		break;
+	case JSON_COLUMN_INTEGER:
+		column->integers[row] = 0;
+		break;
+	case JSON_COLUMN_STRING:
+		column->offsets[row + 1] = column->offsets[row];
+		break;
+	}
+	++column->rows;
+	return 1;
+}
+
+static int column_append_heap(Ctx * ctx, JSONColumn * column, const char * bytes, size_t len) {
+	if (column->heap_size + len > column->heap_capacity) {
+		size_t capacity = column->heap_capacity ? column->heap_capacity : 256;
+		char * heap;
+		while (capacity < column->heap_size + len) {
+			capacity *= 2;
+		}
+		heap = ctx_reallocate(ctx, column->heap, column->heap_capacity, capacity);
+		if (!heap) {
+			return 0;
+		}
+		column->heap = heap;
+		column->heap_capacity = capacity;
+	}
+	memcpy(column->heap + column->heap_size, bytes, len);
+	column->heap_size += len;
+	return 1;
+}
+
+/*
+ * stores the scalar in span into the current row of column, leaving
+ * the row invalid if the value does not have the type of the column.
+ * Only the first occurrence of a field in a record is kept.
+ */
+static int extract_scalar(Extractor * ex, JSONColumn * column, const Span * span) {
+	size_t row = ex->row;
+	int valid = 0;
+	if (column->validity[row / 8] & (1 << (row % 8))) {
+		return 1;
+	}
+	switch (column->type) {
+	case JSON_COLUMN_NUMBER:
+		valid = span->type == TT_NUMBER && span_number(&ex->ctx, span, &column->numbers[row]);
+		break;
+	case JSON_COLUMN_INTEGER:
+		if (span->type == TT_NUMBER) {
+			size_t len = span->end - span->begin;
+			char * buffer_end;
+			if (len > MAX_DOUBLE_DIGITS) {
+				break;
+			}
+			memcpy(ex->ctx.double_buffer, span->begin, len);
+			ex->ctx.double_buffer[len] = '\0';
+			errno = 0;
+			column->integers[row] = strtol(ex->ctx.double_buffer, &buffer_end, 10);
+			valid = !errno && (size_t)(buffer_end - ex->ctx.double_buffer) == len;
+		}
+		break;
+	case JSON_COLUMN_STRING:
+		if (span->type == TT_STRING) {
+			if (span->escaped) {
+				size_t size;
+				char * decoded = span_decode_string(&ex->ctx, span, &size);
+				if (!decoded) {
+					return 0;
+				}
+				valid = column_append_heap(&ex->ctx, column, decoded, size);
+				allocator_free(decoded, size + 1, ex->ctx.allocator);
+			} else {
+				valid = column_append_heap(&ex->ctx, column, span->begin, span->end - span->begin);
+			}
+			if (!valid) {
+				return 0;
+			}
+			column->offsets[row + 1] = column->heap_size;
+		}
+		break;
+	}
+	if (valid) {
+		column->validity[row / 8] |= 1 << (row % 8);
+	}
+	return 1;
+}
+
+static int extract_object(Extractor * ex, size_t depth) {
+	unsigned char * active = ex->active + depth * ex->nfields;
+	unsigned char * next_active = active + ex->nfields;
+	Span key;
+	Span token;
+	for (;;) {
+		int descend = 0;
+		size_t i;
+		scan_token(&ex->ctx.lexer, &key);
+		if (key.type == TT_RBRACE) {
+			return 1;
+		}
+		if (key.type != TT_STRING) {
+			return 0;
+		}
+		scan_token(&ex->ctx.lexer, &token);
+		if (token.type != TT_COLON) {
+			return 0;
+		}
+		scan_token(&ex->ctx.lexer, &token);
+		for (i = 0; i < ex->nfields; i++) {
+			const char * segment;
+			size_t len = 0;
+			int leaf;
+			if (depth + 1 < ex->depth) {
+				next_active[i] = 0;
+			}
+			if (!active[i]) {
+				continue;
+			}
+			segment = path_segment(ex->paths[i], depth, &len);
+			if (!span_equals(&ex->ctx, &key, segment, len)) {
+				continue;
+			}
+			leaf = segment[len] == '\0';
+			if (!leaf) {
+				next_active[i] = 1;
+				descend = 1;
+			} else if (token.type != TT_LBRACE && token.type != TT_LBRACKET) {
+				if (!extract_scalar(ex, &ex->columns[i], &token)) {
+					return 0;
+				}
+			}
+		}
+		if (descend && token.type == TT_LBRACE) {
+			if (!extract_object(ex, depth + 1)) {
+				return 0;
+			}
+		} else if (!scan_skip_value(&ex->ctx.lexer, &token)) {
+			return 0;
+		}
+		scan_token(&ex->ctx.lexer, &token);
+		if (token.type == TT_RBRACE) {
+			return 1;
+		}
+		if (token.type != TT_COMMA) {
+			return 0;
+		}
+	}
+}
+
+static int extract_record(Extractor * ex, const Span * first) {
+	size_t i;
+	for (i = 0; i < ex->nfields; i++) {
+		if (!column_push_row(&ex->ctx, &ex->columns[i])) {
+			return 0;
+		}
+	}
+	if (first->type != TT_LBRACE) {
+		/* records that aren't objects have no fields */
+		return scan_skip_value(&ex->ctx.lexer, first);
+	}
+	for (i = 0; i < ex->nfields; i++) {
+		ex->active[i] = 1;
+	}
+	return extract_object(ex, 0);
+}
+
+void json_columns_free(JSONColumn * columns, size_t ncolumns, JSONAllocator allocator) {
+	size_t i;
+	for (i = 0; i < ncolumns; i++) {
+		JSONColumn * column = &columns[i];
+		if (column->capacity > 0) {
+			allocator_free(column->validity, (column->capacity + 7) / 8, allocator);
+			allocator_free_array(column_data(column), column_data_count(column, column->capacity), column_element_size(column->type), allocator);
+		}
+		allocator_free(column->heap, column->heap_capacity, allocator);
+		column->rows = 0;
+		column->capacity = 0;
+		column->heap = NULL;
+		column->heap_size = 0;
+		column->heap_capacity = 0;
+	}
+}
+
+int json_extract_columns(const char * input, ptrdiff_t len, const char * const * field_paths, size_t nfields, JSONColumn * out_columns, JSONAllocator allocator) {
+	Extractor ex;
+	Span token;
+	size_t i;
+	ex.ctx.allocator = allocator;
+	ex.ctx.lexer = lexer_new(input, len);
+	ex.columns = out_columns;
+	ex.paths = field_paths;
+	ex.nfields = nfields;
+	ex.depth = 1;
+	ex.row = 0;
+	for (i = 0; i < nfields; i++) {
+		size_t depth = path_depth(field_paths[i]);
+		JSONColumn * column = &out_columns[i];
+		if (depth > ex.depth) {
+			ex.depth = depth;
+		}
+		column->rows = 0;
+		column->validity = NULL;
+		column->numbers = NULL;
+		column->integers = NULL;
+		column->offsets = NULL;
+		column->heap = NULL;
+		column->heap_size = 0;
+		column->capacity = 0;
+		column->heap_capacity = 0;
+	}
+	ex.active = NULL;
+	if (nfields > 0) {
+		ex.active = ctx_grow_array(&ex.ctx, NULL, 0, ex.depth, nfields);
+		if (!ex.active) {
+			return 0;
+		}
+	}
+	/* records are simply consecutive values, the newlines between them are whitespace */
+	for (scan_token(&ex.ctx.lexer, &token); token.type != TT_EOF; scan_token(&ex.ctx.lexer, &token)) {
+		if (!extract_record(&ex, &token)) {
+			allocator_free(ex.active, ex.depth * nfields, allocator);
+			json_columns_free(out_columns, nfields, allocator);
+			return 0;
+		}
+		++ex.row;
+	}
+	allocator_free(ex.active, ex.depth * nfields, allocator);
+	return 1;
+}
+
+size_t json_ndjson_split(const char * input, size_t len, size_t nchunks, size_t * bounds) {
+	size_t count = 0;
+	size_t begin = 0;
+	bounds[0] = 0;
+	while (count < nchunks && begin < len) {
+		size_t end = begin + (len - begin) / (nchunks - count);
+		const char * newline;
+		if (end < len) {
+			newline = memchr(input + end, '\n', len - end);
+			end = newline ? (size_t)(newline - input) + 1 : len;
+		}
+		if (end <= begin) {
+			end = len;
+		}
+		bounds[++count] = end;
+		begin = end;
+	}
+	return count;
+}
+
+/*
+ * Filtering walks the input with the scanner like column extraction, and copies
+ * it to the output in as few writes as possible: copied marks the start of the
+ * input not written yet, which is only flushed when a rule changes something.
+ */
+typedef struct {
+	Ctx ctx;
+	const JSONFilterRule * rules;
+	size_t nrules;
+	unsigned long key_rules; /* the rules matching keys at any depth */
+	FILE * file;
+	const char * copied;
+} Filter;
+
+/* where the text of a token starts, as string spans leave out the quotes */
+static const char * span_text(const Span * span) {
+	return span->type == TT_STRING ? span->begin - 1 : span->begin;
+}
+
+static void filter_flush(Filter * filter, const char * end) {
+	fwrite(filter->copied, 1, end - filter->copied, filter->file);
+	filter->copied = end;
+}
+
+/* returns the first rule matching key, or NULL, adding the path rules continuing below key to *next */
+static const JSONFilterRule * filter_match(Filter * filter, unsigned long live, size_t level, const Span * key, unsigned long * next) {
+	const JSONFilterRule * matched = NULL;
+	size_t i;
+	*next = 0;
+	for (i = 0; i < filter->nrules && i < JSON_MAX_FILTER_RULES; i++) {
+		const JSONFilterRule * rule = &filter->rules[i];
+		const char * segment;
+		size_t len;
+		if (rule->key) {
+			if (!matched && span_equals(&filter->ctx, key, rule->key, strlen(rule->key))) {
+				matched = rule;
+			}
+			continue;
+		}
+		if (!(live & (1UL << i)) || !(segment = path_segment(rule->path, level, &len))) {
+			continue;
+		}
+		if (!span_equals(&filter->ctx, key, segment, len)) {
+			continue;
+		}
+		if (segment[len] != '\0') {
+			*next |= 1UL << i;
+		} else if (!matched) {
+			matched = rule;
+		}
+	}
+	return matched;
+}
+
+static int filter_value(Filter * filter, const Span * first, unsigned long live, size_t level);
+
+static int filter_object(Filter * filter, unsigned long live, size_t level) {
+	Lexer * lexer = &filter->ctx.lexer;
+	int emitted = 0;
+	const char * separator = NULL; /* the comma before the current member */
+	Span key;
+	Span token;
+	for (;;) {
+		const char * member = lexer->begin;
+		const JSONFilterRule * rule;
+		unsigned long next;
+		scan_token(lexer, &key);
+		if (key.type == TT_RBRACE) {
+			return 1;
+		}
+		if (key.type != TT_STRING) {
+			return 0;
+		}
+		scan_token(lexer, &token);
+		if (token.type != TT_COLON) {
+			return 0;
+		}
+		scan_token(lexer, &token);
+		rule = filter_match(filter, live, level, &key, &next);
+		if (!rule) {
+			if (!filter_value(filter, &token, next, level + 1)) {
+				return 0;
+			}
+			emitted = 1;
+		} else if (rule->action == JSON_FILTER_KEEP) {
+			if (!scan_skip_value(lexer, &token)) {
+				return 0;
+			}
+			emitted = 1;
+		} else if (rule->action == JSON_FILTER_MASK) {
+			filter_flush(filter, span_text(&token));
+			fputs(rule->mask ? rule->mask : "\"***\"", filter->file);
+			if (!scan_skip_value(lexer, &token)) {
+				return 0;
+			}
+			filter->copied = lexer->begin;
+			emitted = 1;
+		} else {
+			/* the member goes along with the comma before it, or after it when it is the first one written */
+			filter_flush(filter, emitted ? separator : member);
+			if (!scan_skip_value(lexer, &token)) {
+				return 0;
+			}
+			scan_whitespace(lexer);
+			filter->copied = lexer->begin;
+		}
+		scan_token(lexer, &token);
+		if (token.type == TT_RBRACE) {
+			return 1;
+		}
+		if (token.type != TT_COMMA) {
+			return 0;
+		}
+		if (!emitted) {
+			scan_whitespace(lexer);
+			filter->copied = lexer->begin;
+		}
+		separator = token.begin;
+	}
+}
+
+/* the elements of arrays are at the same path as the array */
+static int filter_array(Filter * filter, unsigned long live, size_t level) {
+	Lexer * lexer = &filter->ctx.lexer;
+	Span token;
+	for (;;) {
+		scan_token(lexer, &token);
+		if (token.type == TT_RBRACKET) {
+			return 1;
+		}
+		if (!filter_value(filter, &token, live, level)) {
+			return 0;
+		}
+		scan_token(lexer, &token);
+		if (token.type == TT_RBRACKET) {
+			return 1;
+		}
+		if (token.type != TT_COMMA) {
+			return 0;
+		}
+	}
+}
+
+static int filter_value(Filter * filter, const Span * first, unsigned long live, size_t level) {
+	if (!live && !filter->key_rules) {
+		return scan_skip_value(&filter->ctx.lexer, first);
+	}
+	switch (first->type) {
+	case TT_LBRACE:
+		return filter_object(filter, live, level);
+	case TT_LBRACKET:
+		return filter_array(filter, live, level);
+	default:
+		return scan_skip_value(&filter->ctx.lexer, first);
+	}
+}
+
+int json_filter(const char * input, ptrdiff_t len, const JSONFilterRule * rules, size_t nrules, FILE * file) {
+	Filter filter;
+	Span token;
+	unsigned long paths = 0;
+	size_t i;
+	filter.ctx.allocator = json_default_allocator();
+	filter.ctx.lexer = lexer_new(input, len);
+	filter.rules = rules;
+	filter.nrules = nrules;
+	filter.key_rules = 0;
+	filter.file = file;
+	filter.copied = filter.ctx.lexer.begin;
+	for (i = 0; i < nrules && i < JSON_MAX_FILTER_RULES; i++) {
+		if (rules[i].key) {
+			filter.key_rules |= 1UL << i;
+		} else {
+			paths |= 1UL << i;
+		}
+	}
+	/* records are simply consecutive values, and everything between them is copied */
+	for (scan_token(&filter.ctx.lexer, &token); token.type != TT_EOF; scan_token(&filter.ctx.lexer, &token)) {
+		if (!filter_value(&filter, &token, paths, 0)) {
+			return 0;
+		}
+	}
+	filter_flush(&filter, filter.ctx.lexer.end);
+	return !ferror(file);
+}
 
-static void print_string(FILE * file, const char * str) {
-	char c;
-	fputc('\"', file);
-	for (c = *str; c != '\0'; ++str, c = *str) {
-		switch (c) {
-			case '\b':
-				c = 'b';
-				break;
-			case '\f':
-				c = 'f';
-				break;
-			case '\n':
-				c = 'n';
-				break;
-			case '\r':
-				c = 'r';
-				break;
-			case '\"':
-				c = '\"';
-				break;
-			case '\\':
-				c = '\\';
-				break;
-			default:
-				goto end;
+/*
+ * A sidecar index records where each element of a large array, or each record
+ * of newline delimited JSON, lies in the file, so that single elements can be
+ * parsed straight from a mapping of it. With a key path, it also holds the hashes
+ * of the elements' keys sorted, and lookups check the candidates against the text.
+ *
+ * The index file holds "JSONIDX2", then the length of the input, the count, the key path's
+ * length and bytes, the key count, count pairs of offset and length, and key count pairs
+ * of hash and element sorted by hash, as little endian 64 bit numbers. Without a key path,
+ * the key count is 0.
+ */
+typedef struct {
+	unsigned long hash;
+	size_t element;
+} IndexKey;
+
+struct JSONIndex {
+	size_t count;
+	size_t * offsets;
+	size_t * lengths;
+	char * key_path; /* or NULL */
+	size_t key_count;
+	IndexKey * keys;
+	size_t capacity; /* of offsets, lengths and keys while building */
+	size_t input_size; /* the length of the indexed input */
+	JSONAllocator allocator;
+};
+
+#define INDEX_MAGIC "JSONIDX2"
+
+static unsigned long index_hash(const char * bytes, size_t len) {
+	unsigned long hash = 2166136261UL;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		hash = ((hash ^ (unsigned char)bytes[i]) * 16777619UL) & 0xFFFFFFFFUL;
+	}
+	return hash;
+}
+
+/* skips the value starting with first, finding the string or number at path within it */
+static int index_scan(Ctx * ctx, const Span * first, const char * path, Span * key, int * found) {
+	const char * end;
+	size_t len;
+	Span member;
+	Span token;
+	if (first->type != TT_LBRACE || !path) {
+		return scan_skip_value(&ctx->lexer, first);
+	}
+	end = strchr(path, '.');
+	len = end ? (size_t)(end - path) : strlen(path);
+	for (;;) {
+		scan_token(&ctx->lexer, &member);
+		if (member.type == TT_RBRACE) {
+			return 1;
+		}
+		if (member.type != TT_STRING) {
+			return 0;
+		}
+		scan_token(&ctx->lexer, &token);
+		if (token.type != TT_COLON) {
+			return 0;
+		}
+		scan_token(&ctx->lexer, &token);
+		if (!*found && span_equals(ctx, &member, path, len)) {
+			if (end) {
+				if (!index_scan(ctx, &token, end + 1, key, found)) {
+					return 0;
+				}
+			} else {
+				if (token.type == TT_STRING || token.type == TT_NUMBER) {
+					*key = token;
+					/* only string spans set it */
+					key->escaped = token.type == TT_STRING && token.escaped;
+					*found = 1;
+				}
+				if (!scan_skip_value(&ctx->lexer, &token)) {
+					return 0;
+				}
+			}
+		} else if (!scan_skip_value(&ctx->lexer, &token)) {
+			return 0;
+		}
+		scan_token(&ctx->lexer, &token);
+		if (token.type == TT_RBRACE) {
+			return 1;
+		}
+		if (token.type != TT_COMMA) {
+			return 0;
 		}
-		fputc('\\', file);
-end:;
-		fputc(c, file);
 	}
-	fputc('\"', file);
 }
 
-static void print_obj(FILE * file, const JSONObject * obj, size_t indent) {
-	fputs("{", file);
-	if (obj->count > 0) {
-		size_t i = 0;
-		for (;;) {
-			char * str;
-			fputc('\n', file);
-			print_indent(file, indent + 1);
-			str = obj->strings[i];
-			print_string(file, str);
-			fputs(": ", file);
-			print_value(file, obj->values[i], indent + 1);
-			++i;
-			if (i == obj->count) {
-				break;
+/* the hash of a key span, with strings decoded; returns 0 on invalid escapes */
+static int index_key_hash(Ctx * ctx, const Span * key, unsigned long * hash) {
+	char * decoded;
+	size_t size;
+	if (!key->escaped) {
+		*hash = index_hash(key->begin, key->end - key->begin);
+		return 1;
+	}
+	decoded = span_decode_string(ctx, key, &size);
+	if (!decoded) {
+		return 0;
+	}
+	*hash = index_hash(decoded, size);
+	allocator_free(decoded, size + 1, ctx->allocator);
+	return 1;
+}
+
+static int index_push(Ctx * ctx, JSONIndex * index, size_t offset, size_t length, const Span * key, int found) {
+	if (index->count == index->capacity) {
+		size_t new_capacity = index->capacity ? index->capacity * 2 : 1024;
+		size_t * offsets = ctx_grow_array(ctx, index->offsets, index->capacity, new_capacity, sizeof(*offsets));
+		size_t * lengths;
+		if (!offsets) {
+			return 0;
+		}
+		index->offsets = offsets;
+		lengths = ctx_grow_array(ctx, index->lengths, index->capacity, new_capacity, sizeof(*lengths));
+		if (!lengths) {
+			return 0;
+		}
+		index->lengths = lengths;
+		if (index->key_path) {
+			IndexKey * keys = ctx_grow_array(ctx, index->keys, index->capacity, new_capacity, sizeof(*keys));
+			if (!keys) {
+				return 0;
 			}
-			fputs(",", file);
+			index->keys = keys;
 		}
-		fputc('\n', file);
-		print_indent(file, indent - 1);
+		index->capacity = new_capacity;
 	}
-	fputc('}', file);
+	if (found) {
+		IndexKey * entry = &index->keys[index->key_count];
+		if (!index_key_hash(ctx, key, &entry->hash)) {
+			return 0;
+		}
+		entry->element = index->count;
+		++index->key_count;
+	}
+	index->offsets[index->count] = offset;
+	index->lengths[index->count] = length;
+	++index->count;
+	return 1;
 }
 
-static void print_array(FILE * file, const JSONArray * array, size_t indent) {
-	fputs("[", file);
-	if (array->size > 0) {
-		size_t i;
-		for (i = 0;;) {
-			fputc('\n', file);
-			print_indent(file, indent + 1);
-			print_value(file, array->values[i], indent + 1);
-			++i;
-			if (i == array->size) {
+static int index_key_compare(const void * a, const void * b) {
+	const IndexKey * x = a;
+	const IndexKey * y = b;
+	if (x->hash != y->hash) {
+		return x->hash < y->hash ? -1 : 1;
+	}
+	return x->element < y->element ? -1 : x->element > y->element;
+}
+
+static JSONIndex * index_new(const char * key_path, JSONAllocator allocator) {
+	JSONIndex * index = allocator.callback(allocator.ctx, NULL, 0, sizeof(JSONIndex));
+	if (!index) {
+		return NULL;
+	}
+	index->count = 0;
+	index->offsets = NULL;
+	index->lengths = NULL;
+	index->key_path = NULL;
+	index->key_count = 0;
+	index->keys = NULL;
+	index->capacity = 0;
+	index->input_size = 0;
+	index->allocator = allocator;
+	if (key_path) {
+		size_t len = strlen(key_path) + 1;
+		index->key_path = allocator.callback(allocator.ctx, NULL, 0, len);
+		if (!index->key_path) {
+			allocator_free(index, sizeof(JSONIndex), allocator);
+			return NULL;
+		}
+		memcpy(index->key_path, key_path, len);
+	}
+	return index;
+}
+
+void json_index_free(JSONIndex * index) {
+	JSONAllocator allocator = index->allocator;
+	allocator_free_array(index->offsets, index->capacity, sizeof(*index->offsets), allocator);
+	allocator_free_array(index->lengths, index->capacity, sizeof(*index->lengths), allocator);
+	allocator_free_array(index->keys, index->key_path ? index->capacity : 0, sizeof(*index->keys), allocator);
+	if (index->key_path) {
+		allocator_free(index->key_path, strlen(index->key_path) + 1, allocator);
+	}
+	allocator_free(index, sizeof(JSONIndex), allocator);
+}
+
+JSONIndex * json_index_build(const char * input, size_t len, JSONIndexLayout layout, const char * key_path, JSONAllocator allocator) {
+	JSONIndex * index = index_new(key_path, allocator);
+	Ctx ctx;
+	Span token;
+	if (!index) {
+		return NULL;
+	}
+	index->input_size = len;
+	ctx.allocator = allocator;
+	ctx.lexer = lexer_new(input, len);
+	if (layout == JSON_INDEX_ARRAY) {
+		scan_token(&ctx.lexer, &token);
+		if (token.type != TT_LBRACKET) {
+			goto error;
+		}
+	}
+	for (;;) {
+		Span key;
+		int found = 0;
+		const char * begin;
+		scan_token(&ctx.lexer, &token);
+		if (layout == JSON_INDEX_RECORDS ? token.type == TT_EOF : token.type == TT_RBRACKET) {
+			break;
+		}
+		begin = span_text(&token);
+		if (!index_scan(&ctx, &token, index->key_path, &key, &found)
+				|| !index_push(&ctx, index, begin - input, ctx.lexer.begin - begin, &key, found)) {
+			goto error;
+		}
+		if (layout == JSON_INDEX_ARRAY) {
+			scan_token(&ctx.lexer, &token);
+			if (token.type == TT_RBRACKET) {
 				break;
 			}
-			fputs(",", file);
+			if (token.type != TT_COMMA) {
+				goto error;
+			}
 		}
-		fputc('\n', file);
-		print_indent(file, indent - 1);
 	}
-	fputc(']', file);
+	if (index->key_count > 0) {
+		qsort(index->keys, index->key_count, sizeof(*index->keys), index_key_compare);
+	}
+	return index;
+error:
+	json_index_free(index);
+	return NULL;
 }
 
-static void print_value(FILE * file, const JSONValue * value, size_t indent) {
-	switch (value->type) {
-	case JSON_NULL:
-		fputs("null", file);
-		break;
-	case JSON_BOOL:
-		fputs(json_value_as_bool(value) ? "true" : "false", file);
-		break;
-	case JSON_NUMBER:
-		fprintf(file, "%.17g", json_value_as_number(value));
-		break;
-	case JSON_STRING:
-		print_string(file, json_value_as_string(value));
-		break;
-	case JSON_ARRAY:
-		print_array(file, json_value_as_array(value), indent + 1);
-		break;
-	case JSON_OBJ:
-		print_obj(file, json_value_as_object(value), indent + 1);
-		break;
-	}
+size_t json_index_count(const JSONIndex * index) {
+	return index->count;
 }
 
-int json_print(FILE * file, const JSONValue * value) {
-	print_value(file, value, 0);
-	putc('\n', file);
-	return ferror(file);
+/* whether the nth element lies within an input of len bytes */
+static int index_element_fits(const JSONIndex * index, size_t n, size_t len) {
+	return index->offsets[n] <= len && index->lengths[n] <= len - index->offsets[n];
 }
 
-void print_value_min(FILE * file, const JSONValue * value) {
-	char * sep;
-	const JSONArray * array;
-	const JSONObject * object;
-	size_t i;
-	switch (value->type) {
-	case JSON_NULL:
-		fputs("null", file);
-		break;
-	case JSON_BOOL:
-		fputs(json_value_as_bool(value) ? "true" : "false", file);
-		break;
-	case JSON_NUMBER:
-		fprintf(file, "%.17g", json_value_as_number(value));
-		break;
-	case JSON_STRING:
-		print_string(file, json_value_as_string(value));
-		break;
-	case JSON_ARRAY:
-		fputc('[', file);
-		sep = "";
-		array = json_value_as_array(value);
-		for (i = 0; i < array->size; i++) {
-			fputs(sep, file);
-			print_value_min(file, array->values[i]);
-			sep = ",";
+int json_index_element(const JSONIndex * index, size_t len, size_t n, size_t * offset, size_t * length) {
+	if (n >= index->count || !index_element_fits(index, n, len)) {
+		return 0;
+	}
+	*offset = index->offsets[n];
+	*length = index->lengths[n];
+	return 1;
+}
+
+int json_index_find(const JSONIndex * index, const char * input, size_t len, const char * key, size_t * offset, size_t * length) {
+	size_t key_length = strlen(key);
+	unsigned long hash = index_hash(key, key_length);
+	size_t low = 0;
+	size_t high = index->key_count;
+	Ctx ctx;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (index->keys[middle].hash < hash) {
+			low = middle + 1;
+		} else {
+			high = middle;
 		}
-		fputc(']', file);
-		break;
-	case JSON_OBJ:
-		fputc('{', file);
-		sep  = "";
-		object = json_value_as_object(value);
-		for ( i = 0; i < object->count; i++) {
-			fputs(sep, file);
-			print_string(file, object->strings[i]);
-			fputc(':', file);
-			print_value_min(file, object->values[i]);
-			sep  = ",";
+	}
+	ctx.allocator = json_default_allocator();
+	/* the elements with the same hash are checked in turn */
+	for (; low < index->key_count && index->keys[low].hash == hash; low++) {
+		size_t element = index->keys[low].element;
+		Span token;
+		Span found_key;
+		int found = 0;
+		if (!index_element_fits(index, element, len)) {
+			continue;
+		}
+		ctx.lexer = lexer_new(input + index->offsets[element], index->lengths[element]);
+		scan_token(&ctx.lexer, &token);
+		if (index_scan(&ctx, &token, index->key_path, &found_key, &found) && found && span_equals(&ctx, &found_key, key, key_length)) {
+			*offset = index->offsets[element];
+			*length = index->lengths[element];
+			return 1;
 		}
-		fputc('}', file);
-		break;
 	}
+	return 0;
 }
 
-int json_print_minified(FILE * file, const JSONValue * value) {
-	print_value_min(file, value);
+static void index_write_number(FILE * file, size_t number) {
+	int i;
+	for (i = 0; i < 8; i++) {
+		putc((int)(number & 0xFF), file);
+		/* in two steps, as size_t may only have 32 bits */
+		number = (number >> 4) >> 4;
+	}
+}
+
+/* fails at the end of the file, or on numbers too large for size_t */
+static int index_read_number(FILE * file, size_t * number) {
+	unsigned char bytes[8];
+	size_t value = 0;
+	int i;
+	if (fread(bytes, 1, 8, file) != 8) {
+		return 0;
+	}
+	for (i = 7; i >= 0; i--) {
+		if (value > ((size_t)-1 >> 8)) {
+			return 0;
+		}
+		value = (value << 8) | bytes[i];
+	}
+	*number = value;
+	return 1;
+}
+
+int json_index_write(const JSONIndex * index, FILE * file) {
+	size_t i;
+	size_t path_length = index->key_path ? strlen(index->key_path) : 0;
+	fwrite(INDEX_MAGIC, 1, 8, file);
+	index_write_number(file, index->input_size);
+	index_write_number(file, index->count);
+	index_write_number(file, path_length);
+	if (path_length > 0) {
+		fwrite(index->key_path, 1, path_length, file);
+	}
+	index_write_number(file, index->key_count);
+	for (i = 0; i < index->count; i++) {
+		index_write_number(file, index->offsets[i]);
+		index_write_number(file, index->lengths[i]);
+	}
+	for (i = 0; i < index->key_count; i++) {
+		index_write_number(file, index->keys[i].hash);
+		index_write_number(file, index->keys[i].element);
+	}
 	return ferror(file);
 }
+
+JSONIndex * json_index_read(FILE * file, size_t len, JSONAllocator allocator) {
+	JSONIndex * index = NULL;
+	char magic[8];
+	size_t input_size;
+	size_t count;
+	size_t path_length;
+	size_t i;
+	Ctx ctx;
+	ctx.allocator = allocator;
+	/* an index of another version of the input would point at the wrong text */
+	if (fread(magic, 1, 8, file) != 8 || memcmp(magic, INDEX_MAGIC, 8) != 0
+			|| !index_read_number(file, &input_size) || input_size != len
+			|| !index_read_number(file, &count) || !index_read_number(file, &path_length)) {
+		return NULL;
+	}
+	if (path_length > 0) {
+		char * path = ctx_reallocate(&ctx, NULL, 0, path_length + 1);
+		if (!path) {
+			return NULL;
+		}
+		if (fread(path, 1, path_length, file) == path_length) {
+			path[path_length] = '\0';
+			index = index_new(path, allocator);
+		}
+		allocator_free(path, path_length + 1, allocator);
+	} else {
+		index = index_new(NULL, allocator);
+	}
+	if (!index || !index_read_number(file, &index->key_count) || index->key_count > count || (!index->key_path && index->key_count > 0)) {
+		goto error;
+	}
+	index->input_size = input_size;
+	if (count > 0) {
+		index->offsets = ctx_grow_array(&ctx, NULL, 0, count, sizeof(*index->offsets));
+		index->lengths = ctx_grow_array(&ctx, NULL, 0, count, sizeof(*index->lengths));
+		if (index->key_path) {
+			index->keys = ctx_grow_array(&ctx, NULL, 0, count, sizeof(*index->keys));
+		}
+		index->capacity = count;
+		if (!index->offsets || !index->lengths || (index->key_path && !index->keys)) {
+			goto error;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (!index_read_number(file, &index->offsets[i]) || !index_read_number(file, &index->lengths[i])
+				|| !index_element_fits(index, i, input_size)) {
+			goto error;
+		}
+		++index->count;
+	}
+	for (i = 0; i < index->key_count; i++) {
+		size_t hash;
+		if (!index_read_number(file, &hash) || !index_read_number(file, &index->keys[i].element) || index->keys[i].element >= count
+				|| hash > 0xFFFFFFFFUL) {
+			goto error;
+		}
+		index->keys[i].hash = hash;
+		/* lookups search the hashes by bisection */
+		if (i > 0 && index_key_compare(&index->keys[i - 1], &index->keys[i]) > 0) {
+			goto error;
+		}
+	}
+	return index;
+error:
+	if (index) {
+		json_index_free(index);
+	}
+	return NULL;
+}
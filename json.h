@@ -3,6 +3,11 @@
 
 #include <stdio.h>
 #include <stddef.h>
+#include <limits.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef struct JSONValue JSONValue;
 typedef struct JSONObject JSONObject;
@@ -14,30 +19,158 @@ typedef enum JSONType {
 	JSON_NUMBER,
 	JSON_STRING,
 	JSON_ARRAY,
-	JSON_OBJ
+	JSON_OBJ,
+	JSON_BINARY, /* a base64 string decoded while parsing, see JSONParseOptions */
+	JSON_RAW /* already serialized JSON, printed verbatim, see json_new_raw */
 } JSONType;
 
 typedef void *(* JSONAllocatorCallback)(void * ctx, void * old_alloc, size_t old_size, size_t new_size);
 
+typedef void (* JSONAllocatorFreeAllCallback)(void * ctx);
+
+/* freeing through the callback does nothing, so json_free need not walk documents at all */
+#define JSON_ALLOCATOR_FREE_NOOP 1u
+
+/*
+ * The fields after callback are optional, and zero initializing them
+ * keeps the plain realloc-like behavior.
+ */
 typedef struct JSONAllocator {
 	void * ctx;
 	JSONAllocatorCallback callback;
+	unsigned int flags; /* JSON_ALLOCATOR_ flags */
+	JSONAllocatorFreeAllCallback free_all; /* releases every block at once, or NULL */
 } JSONAllocator;
 
 /**
- * @brief Creates a new JSONAllocator
+ * @brief Creates a new JSONAllocator, with no flags or free_all hook
  * @param ctx serves as the closure of the allocator, and passed to the callback
  * @param callback called to allocate/free memory
  * @return A new JSONAllocator
  */
 JSONAllocator json_allocator_new(void * ctx, JSONAllocatorCallback callback);
 
+/**
+ * @brief releases everything allocated through an allocator at once, through its free_all hook
+ * @param allocator is the allocator
+ * @return 1 on success, or 0 if the allocator has no free_all hook
+ */
+int json_allocator_free_all(JSONAllocator allocator);
+
 /**
  * @brief Returns a JSONAllocator wrapping the system allocator
  * @return A new JSONAllocator
  */
 JSONAllocator json_default_allocator(void);
 
+/*
+ * A JSONCachingAllocator sits in front of another allocator, keeping freed blocks
+ * of small sizes (nodes, keys and short arrays) on free lists per size class,
+ * so that later parses reuse them instead of going back to the inner allocator.
+ * It is not thread safe, so each thread should have its own.
+ */
+typedef struct JSONCachingAllocator JSONCachingAllocator;
+
+/**
+ * @brief creates a caching allocator
+ * @param inner is the allocator that blocks are allocated from and finally returned to
+ * @return the caching allocator, or NULL on allocation failure
+ */
+JSONCachingAllocator * json_caching_allocator_new(JSONAllocator inner);
+
+/**
+ * @brief returns the JSONAllocator allocating through a caching allocator
+ */
+JSONAllocator json_caching_allocator(JSONCachingAllocator * cache);
+
+/**
+ * @brief returns every cached block to the inner allocator
+ */
+void json_caching_allocator_trim(JSONCachingAllocator * cache);
+
+/**
+ * @brief returns every cached block to the inner allocator, and frees the caching allocator
+ * (values allocated through it must have been freed first)
+ */
+void json_caching_allocator_free(JSONCachingAllocator * cache);
+
+/*
+ * A JSONArena allocates by bumping through chunks of 2 MB pages, which on Linux
+ * are backed by huge pages where the system allows, cutting TLB misses when walking large documents.
+ * Its allocator's frees do nothing, and json_allocator_free_all rewinds it for reuse.
+ * It is not thread safe.
+ */
+typedef struct JSONArena JSONArena;
+
+/**
+ * @brief creates an arena, mapping its first chunk
+ * @param chunk_size is the size of the chunks, rounded up to 2 MB, or 0 for 2 MB
+ * (larger allocations get chunks of their own)
+ * @return the arena, or NULL on failure
+ */
+JSONArena * json_arena_new(size_t chunk_size);
+
+/**
+ * @brief returns the JSONAllocator allocating from an arena,
+ * flagged JSON_ALLOCATOR_FREE_NOOP and with a free_all hook rewinding the arena
+ */
+JSONAllocator json_arena_allocator(JSONArena * arena);
+
+/**
+ * @brief unmaps every chunk of an arena, and frees it
+ */
+void json_arena_free(JSONArena * arena);
+
+typedef struct JSONParseOptions {
+	/* string values of these keys are decoded from base64 straight into JSON_BINARY values */
+	const char * const * base64_fields;
+	size_t base64_field_count;
+	/* identical values within a document share one node, as with json_dedup */
+	int dedup;
+	/* values at these paths of keys separated by '.' are kept as JSON_RAW text, which is
+	 * checked like the rest of the input but not parsed. Only the first JSON_MAX_RAW_PATHS are used */
+	const char * const * raw_paths;
+	size_t raw_path_count;
+	/* every value remembers the text it was parsed from, which the printers copy until
+	 * it is edited; the input must then outlive the document */
+	int retain_spans;
+} JSONParseOptions;
+
+#define JSON_MAX_RAW_PATHS 32
+
+typedef void (* JSONTask)(void * arg, size_t index);
+typedef void (* JSONExecutorCallback)(void * ctx, JSONTask task, void * arg, size_t count);
+
+/*
+ * A JSONExecutor lets the parallel functions run on the caller's threads.
+ * The callback must call task(arg, i) once for every i below count,
+ * possibly concurrently, and only return once all of the calls have.
+ */
+typedef struct JSONExecutor {
+	void * ctx;
+	JSONExecutorCallback callback;
+} JSONExecutor;
+
+/**
+ * @brief Creates a new JSONExecutor
+ * @param ctx serves as the closure of the executor, and passed to the callback
+ * @param callback called to run a batch of tasks
+ * @return A new JSONExecutor
+ */
+JSONExecutor json_executor_new(void * ctx, JSONExecutorCallback callback);
+
+/**
+ * @brief Returns a JSONExecutor running every task in turn on the calling thread
+ * @return A new JSONExecutor
+ */
+JSONExecutor json_serial_executor(void);
+
+/**
+ * @brief Returns the options json_parse uses
+ * @return A new JSONParseOptions
+ */
+JSONParseOptions json_default_parse_options(void);
+
 /**
  * @brief tries to parse a string into a JSONValue
  * @param string is the input that is to be parsed
@@ -48,16 +181,378 @@ JSONAllocator json_default_allocator(void);
 JSONValue * json_parse(const char * string, ptrdiff_t len, JSONAllocator allocator);
 
 /**
- * @brief frees an allocated JSONValue (avoid calling if allocated with arena-like allocator)
+ * @brief json_parse, with options changing how the values are built
+ * @param options are the options, usually obtained from json_default_parse_options
+ * @return a pointer to the newly allocated JSONValue, or NULL on failure
+ */
+JSONValue * json_parse_with_options(const char * string, ptrdiff_t len, JSONAllocator allocator, const JSONParseOptions * options);
+
+/* a UTF-16 code unit */
+typedef unsigned short JSONChar16;
+
+/* a UTF-32 code unit, in the smallest unsigned type of at least 32 bits */
+#if UINT_MAX >= 0xFFFFFFFFUL
+typedef unsigned int JSONChar32;
+#else
+typedef unsigned long JSONChar32;
+#endif
+
+/**
+ * @brief json_parse_with_options for UTF-16 text, such as files exported on Windows,
+ * which is transcoded to UTF-8 as it is parsed, a window at a time rather than copied whole
+ * @param input holds the code units in native byte order. A leading byte order mark is skipped,
+ * and one in the opposite order has every unit read byte swapped
+ * @param len is the number of code units; -1 indicates a NULL terminated string
+ * @param options are the parse options, or NULL for the defaults. retain_spans isn't supported,
+ * as the text the spans would refer to isn't kept
+ * @return a pointer to the newly allocated JSONValue, or NULL on failure, including unpaired surrogates
+ */
+JSONValue * json_parse_utf16(const JSONChar16 * input, ptrdiff_t len, JSONAllocator allocator, const JSONParseOptions * options);
+
+/**
+ * @brief json_parse_utf16 for UTF-32 text
+ * @return a pointer to the newly allocated JSONValue, or NULL on failure, including surrogates and units past U+10FFFF
+ */
+JSONValue * json_parse_utf32(const JSONChar32 * input, ptrdiff_t len, JSONAllocator allocator, const JSONParseOptions * options);
+
+/**
+ * @brief parses many independent documents, spread over nworkers tasks of executor
+ * @param inputs are the documents
+ * @param lens are the lengths of the documents; -1 indicates a NULL terminated string
+ * @param n is the number of documents
+ * @param results receives the parsed documents, with NULL for the ones that failed
+ * @param workers receives the index of the worker that parsed each document, which must be freed with
+ * that worker's allocator. It may be NULL when all the allocators free each other's memory
+ * @param allocators holds one allocator per worker, which must not be shared unless it is thread safe
+ * @param nworkers is the number of workers, each claiming the next unparsed document until none are left,
+ * and reusing one parsing context for all of its documents
+ * @param options are the parse options, or NULL for the defaults
+ * @param executor runs the workers, which claim documents atomically when built with GCC, Clang or MSVC;
+ * with other compilers it must run them one at a time, as json_serial_executor does
+ * @return the number of documents parsed successfully
+ */
+size_t json_parse_batch(const char * const * inputs, const ptrdiff_t * lens, size_t n, JSONValue ** results, size_t * workers, const JSONAllocator * allocators, size_t nworkers, const JSONParseOptions * options, JSONExecutor executor);
+
+/*
+ * A JSONParser parses any number of documents, keeping its scratch memory
+ * and learning the usual sizes of the arrays and objects at each depth,
+ * so that later documents of the same shape are parsed with about one allocation per container.
+ * It is not thread safe.
+ */
+typedef struct JSONParser JSONParser;
+
+/**
+ * @brief creates a reusable parser
+ * @param allocator allocates the parser and the documents it parses
+ * @param options are the parse options, copied into the parser, or NULL for the defaults
+ * @return the parser, or NULL on allocation failure
+ */
+JSONParser * json_parser_new(JSONAllocator allocator, const JSONParseOptions * options);
+
+/**
+ * @brief parses a document with a reusable parser, the same as json_parse_with_options
+ * @return the document, which is freed with json_free and the parser's allocator, or NULL on failure
+ */
+JSONValue * json_parser_parse(JSONParser * parser, const char * string, ptrdiff_t len);
+
+/**
+ * @brief frees a parser, but not the documents it parsed
+ */
+void json_parser_free(JSONParser * parser);
+
+typedef enum JSONParseStatus {
+	JSON_PARSE_MORE, /* json_parse_step has to be called again */
+	JSON_PARSE_DONE, /* the document is ready for json_parser_result */
+	JSON_PARSE_ERROR /* the input is invalid, or memory ran out */
+} JSONParseStatus;
+
+/**
+ * @brief starts parsing a document in steps with json_parse_step,
+ * cancelling any parse the parser was in the middle of
+ * @param string is the text, which has to stay alive until the parse ends
+ * @param len is the length of the text; -1 indicates a NULL terminated string
+ */
+void json_parser_begin(JSONParser * parser, const char * string, ptrdiff_t len);
+
+/**
+ * @brief advances the parse started by json_parser_begin, stopping at the first token boundary
+ * after max_bytes of input, so that event loops can parse large documents between other work
+ * @param max_bytes is the amount of input to get through, or 0 to finish the parse
+ * @return JSON_PARSE_MORE if the parse is unfinished, JSON_PARSE_DONE once the document is complete,
+ * or JSON_PARSE_ERROR, after which everything parsed so far has been freed
+ */
+JSONParseStatus json_parse_step(JSONParser * parser, size_t max_bytes);
+
+/**
+ * @brief takes the document of a parse that json_parse_step finished
+ * @return the document, which is freed with json_free and the parser's allocator,
+ * or NULL if the parse isn't done
+ */
+JSONValue * json_parser_result(JSONParser * parser);
+
+/**
+ * @brief abandons a parse in progress, freeing everything parsed so far
+ * (and a finished document that wasn't taken). Does nothing if there is no parse
+ */
+void json_parser_cancel(JSONParser * parser);
+
+/**
+ * @brief frees an allocated JSONValue, returning at once for allocators flagged JSON_ALLOCATOR_FREE_NOOP
+ * Values shared with json_retain only lose one reference, and are freed along with the last one.
  * @param value is a pointer to the JSONValue being freed
  * @param allocator is the allocator that will free the value (preferably be the same one that allocated it)
  */
 void json_free(JSONValue * value, JSONAllocator allocator);
 
+/**
+ * @brief adds a reference to a value, so that it can be shared between documents or threads
+ * without copying it. The count is atomic when built with GCC, Clang or MSVC.
+ * @param value is the value, which may be any subtree of a document
+ * @return value
+ */
+JSONValue * json_retain(JSONValue * value);
+
+/**
+ * @brief drops a reference taken with json_retain, the same as json_free
+ * @param value is the value
+ * @param allocator is the allocator that will free the value if this was the last reference
+ */
+void json_release(JSONValue * value, JSONAllocator allocator);
+
+/**
+ * @brief returns the null value, which is never allocated
+ */
+JSONValue * json_new_null(void);
+
+/**
+ * @brief returns the true or false value, which are never allocated
+ */
+JSONValue * json_new_bool(int boolean);
+
+/**
+ * @brief allocates a number value
+ * @return the value, or NULL on allocation failure
+ */
+JSONValue * json_new_number(double number, JSONAllocator allocator);
+
+/**
+ * @brief allocates a string value, copying the string
+ * @param string is the string, which is not required to be null terminated
+ * @param length is the length of the string
+ * @return the value, or NULL on allocation failure
+ */
+JSONValue * json_new_string(const char * string, size_t length, JSONAllocator allocator);
+
+/**
+ * @brief allocates a JSON_RAW value, copying text that is already serialized JSON,
+ * which the printers write out verbatim. The text is not checked.
+ * @param text is the text, which is not required to be null terminated
+ * @param length is the length of the text
+ * @return the value, or NULL on allocation failure
+ */
+JSONValue * json_new_raw(const char * text, size_t length, JSONAllocator allocator);
+
+/**
+ * @brief allocates an array holding values
+ * @param values are the values, whose references are taken over by the array on success
+ * (use json_retain to keep one); on failure they are still the caller's
+ * @param size is the number of values
+ * @return the value, or NULL on allocation failure
+ */
+JSONValue * json_new_array(JSONValue * const * values, size_t size, JSONAllocator allocator);
+
+/**
+ * @brief allocates an object holding values, copying the keys
+ * @param keys are the keys, which should be unique
+ * @param values are the values, whose references are taken over by the object on success
+ * (use json_retain to keep one); on failure they are still the caller's
+ * @param count is the number of keys and values
+ * @return the value, or NULL on allocation failure
+ */
+JSONValue * json_new_object(const char * const * keys, JSONValue * const * values, size_t count, JSONAllocator allocator);
+
+/**
+ * @brief finds the text a value was parsed from, for documents parsed with retain_spans
+ * @param begin receives the start of the text in the input
+ * @param length receives the length of the text
+ * @return 1 on success, 0 if the value has no span or was edited since parsing
+ */
+int json_value_span(const JSONValue * value, const char ** begin, size_t * length);
+
+/**
+ * @brief records that a value no longer matches its source text, so that the printers
+ * format it instead of copying the text. The setters below do this themselves
+ * for the containers they change; containers holding those have to be marked too
+ */
+void json_mark_dirty(JSONValue * value);
+
+/**
+ * @brief replaces the value at index of an array, or appends it when index is the array's length
+ * @param array is the array, which must not be shared (see json_retain) or static
+ * @param value is the new value, whose reference is taken over on success; on failure it is still the caller's
+ * @param allocator is the allocator of the array
+ * @return 1 on success, 0 on failure
+ */
+int json_array_set(JSONValue * array, size_t index, JSONValue * value, JSONAllocator allocator);
+
+/**
+ * @brief replaces the value of a key of an object, or adds the key after the others
+ * @param object is the object, which must not be shared (see json_retain) or static
+ * @param value is the new value, whose reference is taken over on success; on failure it is still the caller's
+ * @param allocator is the allocator of the object
+ * @return 1 on success, 0 on failure
+ */
+int json_object_set(JSONValue * object, const char * key, JSONValue * value, JSONAllocator allocator);
+
+/**
+ * @brief sets the value at a path of keys separated by '.', where the segments
+ * index arrays as decimal numbers, marking every container on the way dirty
+ * @param value is the new value, whose reference is taken over on success; on failure it is still the caller's
+ * @return 1 on success, 0 if the path doesn't lead into an existing container that isn't shared, or on failure
+ */
+int json_set_path(JSONValue * root, const char * path, JSONValue * value, JSONAllocator allocator);
+
+/**
+ * @brief updates a document parsed with retain_spans after an edit of its text, by reparsing
+ * only the innermost container around the edit and moving the other spans into the new text
+ * @param doc is the document, which has to match old_text, i.e. not have been edited through the setters
+ * @param old_text is the text doc was parsed (or last reparsed) from
+ * @param new_text is the edited text, which the document refers to from then on. It may be old_text
+ * itself when the text was edited in place, and then only the spans from the edit on are moved
+ * @param edit_offset is where the edit starts, in both texts
+ * @param removed_length is the number of bytes of old_text that the edit replaced
+ * @param inserted_length is the number of bytes that replaced them in new_text
+ * @param options are the options doc was parsed with, which must include retain_spans but not dedup
+ * @return the document, which is a new value if the whole document was reparsed, or NULL
+ * if options is NULL, the edit isn't inside the brackets of the root, the new text is invalid,
+ * a span that has to move is in a subtree that is shared (see json_retain and json_dedup), or on failure.
+ * doc is left as it was then, and the new text should be parsed in full
+ */
+JSONValue * json_reparse(JSONValue * doc, const char * old_text, const char * new_text, size_t edit_offset, size_t removed_length, size_t inserted_length, JSONAllocator allocator, const JSONParseOptions * options);
+
+typedef struct JSONReclaimNode JSONReclaimNode;
+
+/*
+ * A JSONReclaimer holds values handed off by json_free_async, until
+ * json_reclaimer_drain frees them, e.g. on a background thread or when an event loop is idle.
+ * Handing off and draining may happen on different threads when built with GCC, Clang or MSVC.
+ */
+typedef struct JSONReclaimer {
+	JSONReclaimNode * volatile head;
+	JSONReclaimNode * pending; /* left over by a partial drain, only touched by the draining thread */
+} JSONReclaimer;
+
+/**
+ * @brief initializes an empty JSONReclaimer
+ * @param reclaimer is the reclaimer, which must not be copied afterwards
+ */
+void json_reclaimer_init(JSONReclaimer * reclaimer);
+
+/**
+ * @brief hands a value off to be freed later by json_reclaimer_drain, which takes constant time
+ * @param reclaimer is the reclaimer
+ * @param value is the value being freed
+ * @param allocator is the allocator that will free the value, which must be usable from the draining thread
+ */
+void json_free_async(JSONReclaimer * reclaimer, JSONValue * value, JSONAllocator allocator);
+
+/**
+ * @brief frees values handed off to a reclaimer; only one thread may drain a reclaimer at a time
+ * @param reclaimer is the reclaimer
+ * @param max_values is the most values to free in this batch, or 0 to free all of them
+ * @return the number of values freed
+ */
+size_t json_reclaimer_drain(JSONReclaimer * reclaimer, size_t max_values);
+
+/**
+ * @brief makes identical values within a document share one node, freeing the copies.
+ * Containers are changed in place, so the document must not be in use on other threads.
+ * Objects are only identical when their keys are in the same order.
+ * @param value is the document
+ * @param allocator is the allocator of the document
+ * @return value
+ */
+JSONValue * json_dedup(JSONValue * value, JSONAllocator allocator);
+
+/**
+ * @brief json_free, with the values of large containers freed in parallel
+ * @param value is a pointer to the JSONValue being freed
+ * @param allocator is the allocator that will free the value, which must be thread safe
+ * @param executor runs the tasks
+ * @param cutoff is the number of values a container needs to be split into tasks, each freeing cutoff of them
+ */
+void json_free_parallel(JSONValue * value, JSONAllocator allocator, JSONExecutor executor, size_t cutoff);
+
+/**
+ * @brief makes a deep copy of a JSONValue
+ * @param value is the value being copied
+ * @param allocator is the allocator used for the copy
+ * @return the copy, or NULL on failure
+ */
+JSONValue * json_clone(const JSONValue * value, JSONAllocator allocator);
+
+/**
+ * @brief json_clone, with the values of large containers copied in parallel
+ * @param allocator is the allocator used for the copy, which must be thread safe
+ * @param executor runs the tasks
+ * @param cutoff is the number of values a container needs to be split into tasks, each copying cutoff of them
+ * @return the copy, or NULL on failure
+ */
+JSONValue * json_clone_parallel(const JSONValue * value, JSONAllocator allocator, JSONExecutor executor, size_t cutoff);
+
+/**
+ * @brief compares two values structurally, where the order of object keys doesn't matter
+ * @return whether a and b are equal
+ */
+int json_equal(const JSONValue * a, const JSONValue * b);
+
+/**
+ * @brief json_equal, with the values of large containers compared in parallel
+ * @param executor runs the tasks
+ * @param cutoff is the number of values a container needs to be split into tasks, each comparing cutoff of them
+ * @return whether a and b are equal
+ */
+int json_equal_parallel(const JSONValue * a, const JSONValue * b, JSONExecutor executor, size_t cutoff);
+
+/**
+ * @brief hashes a value, so that values equal by json_equal have equal hashes
+ * @return the 32 bit hash
+ */
+unsigned long json_hash(const JSONValue * value);
+
+/**
+ * @brief json_hash, with the values of large containers hashed in parallel
+ * @param allocator provides the scratch space of the tasks
+ * @param executor runs the tasks
+ * @param cutoff is the number of values a container needs to be split into tasks, each hashing cutoff of them
+ * @return the same hash as json_hash
+ */
+unsigned long json_hash_parallel(const JSONValue * value, JSONAllocator allocator, JSONExecutor executor, size_t cutoff);
+
+typedef void (* JSONVisitor)(void * ctx, const JSONValue * value);
+
+/**
+ * @brief calls visitor on value and everything it holds, parents before their values
+ * @param value is the value being visited
+ * @param visitor is called with ctx and every value
+ * @param ctx is passed to the visitor
+ */
+void json_visit(const JSONValue * value, JSONVisitor visitor, void * ctx);
+
+/**
+ * @brief json_visit, with the values of large containers visited in parallel
+ * @param visitor is called concurrently, and with no particular order between the tasks
+ * @param executor runs the tasks
+ * @param cutoff is the number of values a container needs to be split into tasks, each visiting cutoff of them
+ */
+void json_visit_parallel(const JSONValue * value, JSONVisitor visitor, void * ctx, JSONExecutor executor, size_t cutoff);
+
 JSONType json_value_type(const JSONValue * value);
 int json_value_as_bool(const JSONValue * value);
 double json_value_as_number(const JSONValue * value);
 const char * json_value_as_string(const JSONValue * value);
+const unsigned char * json_value_as_binary(const JSONValue * value, size_t * length);
+const char * json_value_as_raw(const JSONValue * value, size_t * length);
 const JSONArray * json_value_as_array(const JSONValue * value);
 const JSONObject * json_value_as_object(const JSONValue * value);
 
@@ -72,6 +567,15 @@ const JSONValue * json_object_get(const JSONObject * obj, const char * key);
 size_t json_array_length(const JSONArray * array);
 size_t json_object_count(const JSONObject * obj);
 
+/**
+ * @brief decodes the base64 contents of a JSON_STRING, or copies the bytes of a JSON_BINARY
+ * @param value is the value being decoded
+ * @param out receives the bytes, or is NULL to only query the decoded size
+ * @param len holds the capacity of out, and receives the decoded size
+ * @return 1 on success, 0 if the value isn't valid base64 or out is too small
+ */
+int json_value_decode_base64(const JSONValue * value, void * out, size_t * len);
+
 /**
  * @brief pretty prints a JSONValue
  * @param file is the object being written to
@@ -88,4 +592,250 @@ int json_print(FILE * file, const JSONValue * value);
  */
 int json_print_minified(FILE * file, const JSONValue * value);
 
+/**
+ * @brief prints a JSONValue compactly, except that values parsed with retain_spans
+ * which haven't been edited since are copied from the input as they were written
+ * @param file is the object being written to
+ * @param value is the value being printed
+ * @return the file's status as ferror(file)
+ */
+int json_print_preserving(FILE * file, const JSONValue * value);
+
+typedef enum JSONTokenType {
+	JSON_TOKEN_NULL,
+	JSON_TOKEN_TRUE,
+	JSON_TOKEN_FALSE,
+	JSON_TOKEN_NUMBER,
+	JSON_TOKEN_STRING,
+	JSON_TOKEN_BEGIN_ARRAY,
+	JSON_TOKEN_END_ARRAY,
+	JSON_TOKEN_BEGIN_OBJECT,
+	JSON_TOKEN_END_OBJECT,
+	JSON_TOKEN_COMMA,
+	JSON_TOKEN_COLON,
+	JSON_TOKEN_EOF,
+	JSON_TOKEN_ERROR
+} JSONTokenType;
+
+/* walks the tokens of a document without allocating anything */
+typedef struct JSONReader {
+	const char * begin;
+	const char * end;
+} JSONReader;
+
+/*
+ * begin and end delimit the raw text of the token,
+ * which for strings is the contents between the quotes, with any escape sequences still in it
+ */
+typedef struct JSONToken {
+	JSONTokenType type;
+	const char * begin;
+	const char * end;
+	int escaped;
+} JSONToken;
+
+/**
+ * @brief Creates a new JSONReader
+ * @param string is the input that is to be read
+ * @param len is the length of the input; -1 indicates a NULL terminated string
+ * @return A new JSONReader
+ */
+JSONReader json_reader_new(const char * string, ptrdiff_t len);
+
+/**
+ * @brief reads the next token, which is JSON_TOKEN_ERROR for malformed input
+ * @param reader is the reader
+ * @return the token
+ */
+JSONToken json_reader_next(JSONReader * reader);
+
+/**
+ * @brief skips the rest of the value that begins with token, only checking that its brackets are balanced
+ * @param reader is the reader token was read from
+ * @param token is the first token of the value
+ * @return 1 on success, 0 on malformed input
+ */
+int json_reader_skip(JSONReader * reader, const JSONToken * token);
+
+/**
+ * @brief converts a number token
+ * @return 1 on success, 0 if token isn't a valid number
+ */
+int json_token_number(const JSONToken * token, double * number);
+
+/**
+ * @brief converts a number token holding an integer which fits in a long
+ * @return 1 on success, 0 otherwise
+ */
+int json_token_integer(const JSONToken * token, long * integer);
+
+/**
+ * @brief decodes the escape sequences of a string token
+ * @param token is the string token
+ * @param out receives the NULL terminated string, and must hold token->end - token->begin + 1 bytes
+ * @return the length of the string, or (size_t)-1 on invalid escape sequences
+ */
+size_t json_token_string(const JSONToken * token, char * out);
+
+typedef enum JSONColumnType {
+	JSON_COLUMN_NUMBER,
+	JSON_COLUMN_INTEGER,
+	JSON_COLUMN_STRING
+} JSONColumnType;
+
+/*
+ * A column of values extracted from a sequence of records.
+ * Row i holds a value when bit (i % 8) of validity[i / 8] is set.
+ * Depending on type, the values are in numbers, integers, or for strings
+ * the bytes heap[offsets[i]] up to heap[offsets[i + 1]], which are not NULL terminated.
+ */
+typedef struct JSONColumn {
+	JSONColumnType type;
+	size_t rows;
+	unsigned char * validity;
+	double * numbers;
+	long * integers;
+	size_t * offsets;
+	char * heap;
+	size_t heap_size;
+	/* bookkeeping for the allocations */
+	size_t capacity;
+	size_t heap_capacity;
+} JSONColumn;
+
+/**
+ * @brief extracts fields of newline delimited JSON records into typed columns without building JSONValues
+ * @param input is the sequence of records
+ * @param len is the length of the input; -1 indicates a NULL terminated string
+ * @param field_paths are the fields to extract, with '.' separating the keys of nested objects
+ * @param nfields is the number of field paths
+ * @param out_columns receives one column per field, the type of each must be set by the caller
+ * @param allocator is the allocator used for the column buffers
+ * @return 1 on success, 0 on failure, in which case nothing is left allocated
+ */
+int json_extract_columns(const char * input, ptrdiff_t len, const char * const * field_paths, size_t nfields, JSONColumn * out_columns, JSONAllocator allocator);
+
+/**
+ * @brief frees the buffers of columns filled by json_extract_columns
+ * @param columns is the array of columns
+ * @param ncolumns is the number of columns
+ * @param allocator is the allocator that was passed to json_extract_columns
+ */
+void json_columns_free(JSONColumn * columns, size_t ncolumns, JSONAllocator allocator);
+
+/**
+ * @brief splits newline delimited records into chunks of roughly equal size, for extracting them in parallel
+ * @param input is the sequence of records
+ * @param len is the length of the input
+ * @param nchunks is the maximum number of chunks
+ * @param bounds receives the count + 1 offsets delimiting the chunks, chunk i being input[bounds[i]] to input[bounds[i + 1]]
+ * @return the number of chunks
+ */
+size_t json_ndjson_split(const char * input, size_t len, size_t nchunks, size_t * bounds);
+
+typedef enum JSONFilterAction {
+	JSON_FILTER_DROP, /* removes the key and its value */
+	JSON_FILTER_MASK, /* replaces the value with the rule's mask */
+	JSON_FILTER_KEEP  /* copies the value as it is, without applying any rules inside it */
+} JSONFilterAction;
+
+/*
+ * A rule of json_filter, which matches either by path or by key.
+ * The first rule matching a key applies.
+ */
+typedef struct JSONFilterRule {
+	/* keys separated by '.' from the root, looking through arrays, or NULL */
+	const char * path;
+	/* a key matching at any depth, or NULL */
+	const char * key;
+	JSONFilterAction action;
+	/* the JSON text written by JSON_FILTER_MASK, or NULL for "***" */
+	const char * mask;
+} JSONFilterRule;
+
+#define JSON_MAX_FILTER_RULES 32
+
+/**
+ * @brief copies JSON text to a file, dropping, masking or keeping the values chosen by rules,
+ * without building JSONValues. The parts that no rule applies to are copied as they are,
+ * whitespace included
+ * @param input is a value, or a sequence of values such as newline delimited records
+ * @param len is the length of the input; -1 indicates a NULL terminated string
+ * @param rules are the rules, of which only the first JSON_MAX_FILTER_RULES are used
+ * @param nrules is the number of rules
+ * @param file is the file being written to
+ * @return 1 on success, 0 on invalid input, after which the output is incomplete, or if the file has an error
+ */
+int json_filter(const char * input, ptrdiff_t len, const JSONFilterRule * rules, size_t nrules, FILE * file);
+
+/*
+ * A JSONIndex records the offset and length of every element of a large array,
+ * or every record of newline delimited JSON, so that single elements can be parsed
+ * from the file (e.g. mapped into memory) without reading the rest.
+ * It can also find elements by the value of a key.
+ */
+typedef struct JSONIndex JSONIndex;
+
+typedef enum JSONIndexLayout {
+	JSON_INDEX_ARRAY, /* the input is one array, whose elements are indexed */
+	JSON_INDEX_RECORDS /* the input is a sequence of values, such as newline delimited records */
+} JSONIndexLayout;
+
+/**
+ * @brief scans an input once, indexing its elements
+ * @param input is the input, which is not required to be null terminated
+ * @param len is the length of the input
+ * @param layout says whether the input is an array or a sequence of records
+ * @param key_path is a path of keys separated by '.' leading to a string or number in each element,
+ * by which json_index_find looks elements up, or NULL
+ * @param allocator allocates the index
+ * @return the index, or NULL on invalid input or allocation failure
+ */
+JSONIndex * json_index_build(const char * input, size_t len, JSONIndexLayout layout, const char * key_path, JSONAllocator allocator);
+
+/**
+ * @brief returns the number of elements of an index
+ */
+size_t json_index_count(const JSONIndex * index);
+
+/**
+ * @brief finds the text of the nth element, which can be parsed with json_parse(input + offset, length, ...)
+ * @param len is the length of the indexed input
+ * @return 1 on success, 0 if there is no such element or it doesn't lie within len bytes
+ */
+int json_index_element(const JSONIndex * index, size_t len, size_t n, size_t * offset, size_t * length);
+
+/**
+ * @brief finds the first element whose value at the index's key path is key
+ * @param input is the indexed input, which the candidates are checked against
+ * @param len is the length of the input; candidates that don't lie within it are skipped
+ * @param key is the key, holding the text of numbers as they were written
+ * @return 1 on success, 0 if there is no such element
+ */
+int json_index_find(const JSONIndex * index, const char * input, size_t len, const char * key, size_t * offset, size_t * length);
+
+/**
+ * @brief writes an index to a file, in a format independent of the platform
+ * @return the file's status as ferror(file)
+ */
+int json_index_write(const JSONIndex * index, FILE * file);
+
+/**
+ * @brief reads an index written by json_index_write
+ * @param len is the length of the input the index is used with, which must be the length it was built from.
+ * Staleness is only detected by that length: an index of another input of the same length is accepted,
+ * though lookups still check keys against the text, and elements outside the input are never returned
+ * @return the index, or NULL if the file isn't a valid index of an input of len bytes or on allocation failure
+ */
+JSONIndex * json_index_read(FILE * file, size_t len, JSONAllocator allocator);
+
+/**
+ * @brief frees an index with the allocator it was built or read with
+ */
+void json_index_free(JSONIndex * index);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,939 @@
+#ifndef LIB_JSON_CONSTEXPR_HPP
+#define LIB_JSON_CONSTEXPR_HPP
+
+/*
+ * Compile time documents for C++20. json::document parses a string literal while
+ * compiling, and lays the result out as static data in the layout of json_static.h,
+ * so it is ready when the program starts, without parsing or allocating:
+ *
+ *     using config = json::document<R"({"host": "localhost", "port": 8080})">;
+ *     static_assert(config::number("port") == 8080);
+ *     const JSONValue * root = config::root();
+ *
+ * Text that isn't JSON fails to compile. The accessors take paths of keys
+ * separated by '.', where the segments index arrays as decimal numbers,
+ * and are resolved while compiling too. Objects with the same keys in the
+ * same order share one shape, as they would when parsed.
+ */
+
+#include "json_static.h"
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace json {
+
+/* a string literal usable as a template argument */
+template <std::size_t N>
+struct literal {
+	char text[N];
+
+	constexpr literal(const char (&string)[N]) : text() {
+		for (std::size_t i = 0; i < N; i++) {
+			text[i] = string[i];
+		}
+	}
+
+	constexpr std::string_view view() const {
+		return std::string_view(text, N - 1);
+	}
+};
+
+namespace detail {
+
+/*
+ * never defined, these are called on errors, which stops the
+ * constant evaluation with their name in the compiler's message
+ */
+void invalid_json();
+void number_out_of_range();
+void path_not_found();
+void value_has_another_type();
+
+/* a parsed value: its type, and its index among the values of that type, or the boolean */
+struct ref {
+	unsigned char type = JSON_NULL;
+	std::size_t index = 0;
+};
+
+struct text_range {
+	std::size_t begin = 0;
+	std::size_t length = 0;
+};
+
+struct container {
+	std::size_t first = 0; /* of the slots holding the values */
+	std::size_t count = 0;
+	std::size_t shape = 0; /* for objects */
+};
+
+/* how many of each thing a document holds, found by parsing it once without keeping anything */
+struct counts {
+	std::size_t numbers = 0;
+	std::size_t strings = 0;
+	std::size_t arrays = 0;
+	std::size_t objects = 0;
+	std::size_t slots = 0; /* the values of arrays and objects */
+	std::size_t chars = 0; /* of strings and keys, with their terminators */
+};
+
+/* the sizes of the static data, which only keeps the keys of distinct shapes */
+struct layout {
+	std::size_t numbers = 0;
+	std::size_t strings = 0;
+	std::size_t arrays = 0;
+	std::size_t objects = 0;
+	std::size_t shapes = 0;
+	std::size_t keys = 0;
+	std::size_t slots = 0;
+	std::size_t chars = 0;
+};
+
+struct counter {
+	static constexpr bool building = false;
+	counts used;
+};
+
+/* the parsed document, with values referring to each other by index */
+template <counts C>
+struct tree {
+	static constexpr bool building = true;
+	counts used; /* how much of each array is filled so far */
+	double numbers[C.numbers + 1] = {};
+	text_range strings[C.strings + 1] = {};
+	container arrays[C.arrays + 1] = {};
+	container objects[C.objects + 1] = {};
+	ref slots[C.slots + 1] = {};
+	text_range keys[C.slots + 1] = {}; /* of the slots of objects */
+	char chars[C.chars + 1] = {};
+	std::size_t shape_objects[C.objects + 1] = {}; /* the first object of each shape */
+	std::size_t shape_count = 0;
+	ref root;
+
+	constexpr bool same_text(text_range a, text_range b) const {
+		if (a.length != b.length) {
+			return false;
+		}
+		for (std::size_t i = 0; i < a.length; i++) {
+			if (chars[a.begin + i] != chars[b.begin + i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	constexpr bool same_keys(const container & a, const container & b) const {
+		if (a.count != b.count) {
+			return false;
+		}
+		for (std::size_t i = 0; i < a.count; i++) {
+			if (!same_text(keys[a.first + i], keys[b.first + i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/* gives every object the shape of the first object with the same keys */
+	constexpr void share_shapes() {
+		for (std::size_t i = 0; i < used.objects; i++) {
+			std::size_t shape = 0;
+			while (shape < shape_count && !same_keys(objects[shape_objects[shape]], objects[i])) {
+				shape++;
+			}
+			if (shape == shape_count) {
+				shape_objects[shape_count++] = i;
+			}
+			objects[i].shape = shape;
+		}
+	}
+
+	constexpr layout static_layout() const {
+		layout sizes;
+		sizes.numbers = used.numbers;
+		sizes.strings = used.strings;
+		sizes.arrays = used.arrays;
+		sizes.objects = used.objects;
+		sizes.shapes = shape_count;
+		sizes.slots = used.slots;
+		for (std::size_t i = 0; i < used.strings; i++) {
+			sizes.chars += strings[i].length + 1;
+		}
+		for (std::size_t i = 0; i < shape_count; i++) {
+			const container & object = objects[shape_objects[i]];
+			sizes.keys += object.count;
+			for (std::size_t j = 0; j < object.count; j++) {
+				sizes.chars += keys[object.first + j].length + 1;
+			}
+		}
+		return sizes;
+	}
+};
+
+/* arbitrary precision unsigned integers, just big enough to round any number the parser accepts */
+struct big_integer {
+	static constexpr std::size_t max_limbs = 160;
+	std::uint32_t limbs[max_limbs] = {};
+	std::size_t size = 0;
+
+	constexpr void multiply_add(std::uint32_t factor, std::uint32_t addend) {
+		std::uint64_t carry = addend;
+		for (std::size_t i = 0; i < size; i++) {
+			carry += (std::uint64_t)limbs[i] * factor;
+			limbs[i] = (std::uint32_t)carry;
+			carry >>= 32;
+		}
+		if (carry) {
+			limbs[size++] = (std::uint32_t)carry;
+		}
+	}
+
+	constexpr std::size_t bit_length() const {
+		if (size == 0) {
+			return 0;
+		}
+		std::size_t bits = size * 32;
+		for (std::uint32_t top = limbs[size - 1]; !(top & 0x80000000u); top <<= 1) {
+			bits--;
+		}
+		return bits;
+	}
+
+	constexpr void shift_left(std::size_t bits) {
+		std::size_t words = bits / 32;
+		bits %= 32;
+		if (size == 0) {
+			return;
+		}
+		limbs[size + words] = 0;
+		for (std::size_t i = size; i-- > 0;) {
+			if (bits) {
+				limbs[i + words + 1] |= limbs[i] >> (32 - bits);
+			}
+			limbs[i + words] = limbs[i] << bits;
+		}
+		for (std::size_t i = 0; i < words; i++) {
+			limbs[i] = 0;
+		}
+		size += words + 1;
+		trim();
+	}
+
+	constexpr void trim() {
+		while (size > 0 && limbs[size - 1] == 0) {
+			size--;
+		}
+	}
+};
+
+/*
+ * the double nearest to mantissa * 2^exponent, where sticky says whether bits
+ * below the mantissa were lost, rounding halfway cases to even
+ */
+constexpr double compose_double(std::uint64_t mantissa, bool sticky, int exponent) {
+	int bits = 0;
+	while (bits < 64 && (mantissa >> bits) != 0) {
+		bits++;
+	}
+	int top = bits - 1 + exponent;
+	int precision = top < DBL_MIN_EXP - 1 ? DBL_MANT_DIG - (DBL_MIN_EXP - 1 - top) : DBL_MANT_DIG;
+	int drop = bits - precision;
+	if (drop > 0) {
+		bool half = drop <= 64 && ((mantissa >> (drop - 1)) & 1);
+		bool rest = sticky || (drop > 1 && (drop > 64 || (mantissa & ((std::uint64_t)-1 >> (65 - drop))) != 0));
+		mantissa = drop < 64 ? mantissa >> drop : 0;
+		if (half && (rest || (mantissa & 1))) {
+			mantissa++;
+		}
+		exponent += drop;
+	}
+	bits = 0;
+	while (bits < 64 && (mantissa >> bits) != 0) {
+		bits++;
+	}
+	if (mantissa == 0 || bits - 1 + exponent >= DBL_MAX_EXP) {
+		number_out_of_range();
+	}
+	/* each step is exact, as every intermediate value lies between the mantissa and the result */
+	double number = (double)mantissa;
+	for (; exponent >= 32; exponent -= 32) {
+		number *= 4294967296.0;
+	}
+	for (; exponent <= -32; exponent += 32) {
+		number /= 4294967296.0;
+	}
+	for (; exponent > 0; exponent--) {
+		number *= 2;
+	}
+	for (; exponent < 0; exponent++) {
+		number /= 2;
+	}
+	return number;
+}
+
+/*
+ * divides dividend by divisor a 32 bit limb at a time (Knuth's algorithm D), leaving
+ * the remainder in dividend. The quotient must fit in 64 bits.
+ */
+constexpr std::uint64_t divide(big_integer & dividend, big_integer divisor) {
+	std::size_t m = divisor.size;
+	std::size_t normalize = 0;
+	while (!((divisor.limbs[m - 1] << normalize) & 0x80000000u)) {
+		normalize++;
+	}
+	divisor.shift_left(normalize);
+	dividend.shift_left(normalize);
+	if (dividend.size < m) {
+		return 0;
+	}
+	std::size_t n = dividend.size;
+	std::uint32_t * u = dividend.limbs;
+	const std::uint32_t * v = divisor.limbs;
+	std::uint64_t quotient = 0;
+	u[n] = 0;
+	for (std::size_t j = n - m + 1; j-- > 0;) {
+		std::uint64_t top = (std::uint64_t)u[j + m] << 32 | u[j + m - 1];
+		std::uint64_t digit = top / v[m - 1];
+		std::uint64_t rest = top % v[m - 1];
+		while (digit >> 32 || (m > 1 && digit * v[m - 2] > (rest << 32 | u[j + m - 2]))) {
+			digit--;
+			rest += v[m - 1];
+			if (rest >> 32) {
+				break;
+			}
+		}
+		std::int64_t borrow = 0;
+		std::int64_t t = 0;
+		for (std::size_t i = 0; i < m; i++) {
+			std::uint64_t product = digit * v[i];
+			t = (std::int64_t)u[i + j] - borrow - (std::int64_t)(product & 0xFFFFFFFFu);
+			u[i + j] = (std::uint32_t)t;
+			borrow = (std::int64_t)(product >> 32) - (t >> 32);
+		}
+		t = (std::int64_t)u[j + m] - borrow;
+		u[j + m] = (std::uint32_t)t;
+		if (t < 0) {
+			/* the estimate was one too large */
+			std::uint64_t carry = 0;
+			digit--;
+			for (std::size_t i = 0; i < m; i++) {
+				carry += (std::uint64_t)u[i + j] + v[i];
+				u[i + j] = (std::uint32_t)carry;
+				carry >>= 32;
+			}
+			u[j + m] += (std::uint32_t)carry;
+		}
+		quotient = quotient << 32 | digit;
+	}
+	dividend.size = n + 1;
+	dividend.trim();
+	return quotient;
+}
+
+/* the double nearest to digits * 10^exponent */
+constexpr double decimal_to_double(const big_integer & digits, long exponent) {
+	big_integer numerator = digits;
+	big_integer denominator;
+	denominator.limbs[0] = 1;
+	denominator.size = 1;
+	big_integer & power = exponent < 0 ? denominator : numerator;
+	for (long i = exponent < 0 ? -exponent : exponent; i > 0; i -= 9) {
+		std::uint32_t factor = 1;
+		for (long j = 0; j < i && j < 9; j++) {
+			factor *= 10;
+		}
+		power.multiply_add(factor, 0);
+	}
+	/* scales the fraction by 2^-binary so that its quotient has 56 bits, enough to round */
+	long binary = (long)numerator.bit_length() - (long)denominator.bit_length() - 55;
+	if (binary < 0) {
+		numerator.shift_left((std::size_t)-binary);
+	} else {
+		denominator.shift_left((std::size_t)binary);
+	}
+	std::uint64_t quotient = divide(numerator, denominator);
+	return compose_double(quotient, numerator.size != 0, (int)binary);
+}
+
+template <class Out>
+struct parser {
+	std::string_view text;
+	std::size_t pos = 0;
+	Out & out;
+
+	constexpr parser(std::string_view text, Out & out) : text(text), out(out) {}
+
+	constexpr char peek() const {
+		return pos < text.size() ? text[pos] : '\0';
+	}
+
+	constexpr char next() {
+		if (pos >= text.size()) {
+			invalid_json();
+		}
+		return text[pos++];
+	}
+
+	constexpr void expect(char c) {
+		if (next() != c) {
+			invalid_json();
+		}
+	}
+
+	constexpr void skip_whitespace() {
+		while (peek() == ' ' || peek() == '\t' || peek() == '\n' || peek() == '\r') {
+			pos++;
+		}
+	}
+
+	/* skips a value the counting pass has already checked, to count the values of containers */
+	constexpr std::size_t skip_value(std::size_t at) const {
+		std::size_t depth = 0;
+		do {
+			char c = text[at++];
+			if (c == '"') {
+				while (text[at] != '"') {
+					at += text[at] == '\\' ? 2 : 1;
+				}
+				at++;
+			} else if (c == '[' || c == '{') {
+				depth++;
+			} else if (c == ']' || c == '}') {
+				depth--;
+			} else if (depth == 0) {
+				while (at < text.size() && text[at] != ',' && text[at] != ']' && text[at] != '}'
+					&& text[at] != ' ' && text[at] != '\t' && text[at] != '\n' && text[at] != '\r') {
+					at++;
+				}
+			}
+		} while (depth > 0);
+		return at;
+	}
+
+	/* the number of values in the container whose opening bracket was just read */
+	constexpr std::size_t count_values(bool object) const {
+		parser scan(text, out);
+		std::size_t count = 0;
+		scan.pos = pos;
+		scan.skip_whitespace();
+		if (scan.peek() == (object ? '}' : ']')) {
+			return 0;
+		}
+		for (;;) {
+			if (object) {
+				scan.pos = scan.skip_value(scan.pos);
+				scan.skip_whitespace();
+				scan.pos++;
+				scan.skip_whitespace();
+			}
+			scan.pos = scan.skip_value(scan.pos);
+			count++;
+			scan.skip_whitespace();
+			if (scan.next() != ',') {
+				return count;
+			}
+			scan.skip_whitespace();
+		}
+	}
+
+	constexpr void put_char(char c) {
+		if constexpr (Out::building) {
+			out.chars[out.used.chars] = c;
+		}
+		out.used.chars++;
+	}
+
+	constexpr void put_codepoint(std::uint32_t codepoint) {
+		if (codepoint < 0x80) {
+			put_char((char)codepoint);
+		} else if (codepoint < 0x800) {
+			put_char((char)(0xC0 | (codepoint >> 6)));
+			put_char((char)(0x80 | (codepoint & 0x3F)));
+		} else if (codepoint < 0x10000) {
+			put_char((char)(0xE0 | (codepoint >> 12)));
+			put_char((char)(0x80 | ((codepoint >> 6) & 0x3F)));
+			put_char((char)(0x80 | (codepoint & 0x3F)));
+		} else {
+			put_char((char)(0xF0 | (codepoint >> 18)));
+			put_char((char)(0x80 | ((codepoint >> 12) & 0x3F)));
+			put_char((char)(0x80 | ((codepoint >> 6) & 0x3F)));
+			put_char((char)(0x80 | (codepoint & 0x3F)));
+		}
+	}
+
+	constexpr std::uint32_t hex_escape() {
+		std::uint32_t codepoint = 0;
+		for (int i = 0; i < 4; i++) {
+			char c = next();
+			codepoint <<= 4;
+			if ('0' <= c && c <= '9') {
+				codepoint |= c - '0';
+			} else if ('a' <= c && c <= 'f') {
+				codepoint |= c - 'a' + 10;
+			} else if ('A' <= c && c <= 'F') {
+				codepoint |= c - 'A' + 10;
+			} else {
+				invalid_json();
+			}
+		}
+		return codepoint;
+	}
+
+	/* decodes a string into the characters of the output, terminating it, as strings and keys are C strings */
+	constexpr text_range string() {
+		text_range range;
+		range.begin = out.used.chars;
+		expect('"');
+		for (char c = next(); c != '"'; c = next()) {
+			if (c != '\\') {
+				put_char(c);
+				continue;
+			}
+			switch (next()) {
+			case 'b': put_char('\b'); break;
+			case 'f': put_char('\f'); break;
+			case 'n': put_char('\n'); break;
+			case 'r': put_char('\r'); break;
+			case 't': put_char('\t'); break;
+			case '"': put_char('"'); break;
+			case '\\': put_char('\\'); break;
+			case '/': put_char('/'); break;
+			case 'u': {
+				std::uint32_t codepoint = hex_escape();
+				if (0xD800 <= codepoint && codepoint <= 0xDBFF) {
+					expect('\\');
+					expect('u');
+					std::uint32_t low = hex_escape();
+					if (low < 0xDC00 || low > 0xDFFF) {
+						invalid_json();
+					}
+					codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+				} else if (codepoint == 0 || (0xDC00 <= codepoint && codepoint <= 0xDFFF)) {
+					invalid_json();
+				}
+				put_codepoint(codepoint);
+				break;
+			}
+			default:
+				invalid_json();
+			}
+		}
+		range.length = out.used.chars - range.begin;
+		put_char('\0');
+		return range;
+	}
+
+	constexpr bool digit() const {
+		return '0' <= peek() && peek() <= '9';
+	}
+
+	/* the numbers of RFC 8259, converted exactly as strtod would */
+	constexpr double number() {
+		std::size_t begin = pos;
+		bool negative = peek() == '-';
+		big_integer digits;
+		std::uint64_t small = 0; /* the digits, while they fit */
+		std::size_t significant = 0;
+		long exponent = 0;
+		if (negative) {
+			pos++;
+		}
+		if (!digit()) {
+			invalid_json();
+		}
+		bool leading_zero = peek() == '0';
+		for (bool fraction = false;; pos++) {
+			if (!digit()) {
+				if (fraction || peek() != '.') {
+					break;
+				}
+				fraction = true;
+				pos++;
+				if (!digit()) {
+					invalid_json();
+				}
+			}
+			std::uint32_t value = peek() - '0';
+			if (significant > 0 || value != 0) {
+				digits.multiply_add(10, value);
+				small = small * 10 + value;
+				significant++;
+			}
+			if (fraction) {
+				exponent--;
+			} else if (leading_zero && pos > begin + negative) {
+				invalid_json();
+			}
+		}
+		if (peek() == 'e' || peek() == 'E') {
+			bool negative_exponent = false;
+			long explicit_exponent = 0;
+			pos++;
+			if (peek() == '+' || peek() == '-') {
+				negative_exponent = next() == '-';
+			}
+			if (!digit()) {
+				invalid_json();
+			}
+			while (digit()) {
+				if (explicit_exponent < 100000) {
+					explicit_exponent = explicit_exponent * 10 + (next() - '0');
+				} else {
+					pos++;
+				}
+			}
+			exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+		}
+		if (pos - begin > 3 + DBL_MANT_DIG - DBL_MIN_EXP) {
+			/* as json_parse, which refuses numbers this long */
+			invalid_json();
+		}
+		if constexpr (!Out::building) {
+			/* converting once, while building, is enough */
+			return 0;
+		}
+		double number = 0;
+		if (significant == 0) {
+			number = 0;
+		} else if ((long)significant + exponent > DBL_MAX_10_EXP + 1 || (long)significant + exponent < DBL_MIN_10_EXP - DBL_DIG - 3) {
+			number_out_of_range();
+		} else if (significant <= 15 && -22 <= exponent && exponent <= 22) {
+			/* both the digits and the power of ten are exact doubles, so one operation rounds correctly */
+			double power = 1;
+			for (long i = 0; i < (exponent < 0 ? -exponent : exponent); i++) {
+				power *= 10;
+			}
+			number = exponent < 0 ? (double)small / power : (double)small * power;
+		} else {
+			number = decimal_to_double(digits, exponent);
+		}
+		return negative ? -number : number;
+	}
+
+	constexpr void literal_word(const char * word) {
+		for (; *word; word++) {
+			expect(*word);
+		}
+	}
+
+	constexpr ref value() {
+		ref result;
+		skip_whitespace();
+		switch (peek()) {
+		case '{':
+			return object();
+		case '[':
+			return array();
+		case '"': {
+			text_range range = string();
+			if constexpr (Out::building) {
+				out.strings[out.used.strings] = range;
+			}
+			result.type = JSON_STRING;
+			result.index = out.used.strings++;
+			return result;
+		}
+		case 't':
+			literal_word("true");
+			result.type = JSON_BOOL;
+			result.index = 1;
+			return result;
+		case 'f':
+			literal_word("false");
+			result.type = JSON_BOOL;
+			return result;
+		case 'n':
+			literal_word("null");
+			return result;
+		default: {
+			double parsed = number();
+			if constexpr (Out::building) {
+				out.numbers[out.used.numbers] = parsed;
+			}
+			result.type = JSON_NUMBER;
+			result.index = out.used.numbers++;
+			return result;
+		}
+		}
+	}
+
+	/* reads the values of an array or object, which are placed together in the slots */
+	constexpr container values(bool object) {
+		container result;
+		std::size_t count = 0;
+		expect(object ? '{' : '[');
+		if constexpr (Out::building) {
+			result.first = out.used.slots;
+			out.used.slots += count_values(object);
+		}
+		skip_whitespace();
+		if (peek() == (object ? '}' : ']')) {
+			pos++;
+			return result;
+		}
+		for (;;) {
+			text_range key;
+			if (object) {
+				skip_whitespace();
+				key = string();
+				skip_whitespace();
+				expect(':');
+			}
+			ref element = value();
+			if constexpr (Out::building) {
+				out.slots[result.first + count] = element;
+				out.keys[result.first + count] = key;
+			}
+			count++;
+			skip_whitespace();
+			char c = next();
+			if (c == (object ? '}' : ']')) {
+				break;
+			}
+			if (c != ',') {
+				invalid_json();
+			}
+		}
+		if constexpr (!Out::building) {
+			out.used.slots += count;
+		}
+		result.count = count;
+		return result;
+	}
+
+	constexpr ref array() {
+		ref result;
+		result.type = JSON_ARRAY;
+		result.index = out.used.arrays++;
+		container array = values(false);
+		if constexpr (Out::building) {
+			out.arrays[result.index] = array;
+		}
+		return result;
+	}
+
+	constexpr ref object() {
+		ref result;
+		result.type = JSON_OBJ;
+		result.index = out.used.objects++;
+		container object = values(true);
+		if constexpr (Out::building) {
+			out.objects[result.index] = object;
+		}
+		return result;
+	}
+
+	constexpr ref document() {
+		ref root = value();
+		skip_whitespace();
+		if (pos != text.size()) {
+			invalid_json();
+		}
+		return root;
+	}
+};
+
+constexpr counts measure(std::string_view text) {
+	counter out;
+	parser<counter>(text, out).document();
+	return out.used;
+}
+
+template <counts C>
+constexpr tree<C> parse(std::string_view text) {
+	tree<C> out;
+	out.root = parser<tree<C>>(text, out).document();
+	out.share_shapes();
+	return out;
+}
+
+/* the static data of a document, in the layout of json_static.h */
+template <layout L>
+struct storage {
+	JSONNumber numbers[L.numbers + 1];
+	JSONString strings[L.strings + 1];
+	JSONArray arrays[L.arrays + 1];
+	JSONObject objects[L.objects + 1];
+	JSONShape shapes[L.shapes + 1];
+	char * keys[L.keys + 1];
+	JSONValue * slots[L.slots + 1];
+	char chars[L.chars + 1];
+};
+
+template <layout L>
+constexpr JSONValue * node(ref value, storage<L> * data) {
+	switch (value.type) {
+	case JSON_BOOL:
+		return value.index ? &json_true : &json_false;
+	case JSON_NUMBER:
+		return &data->numbers[value.index].value;
+	case JSON_STRING:
+		return &data->strings[value.index].value;
+	case JSON_ARRAY:
+		return &data->arrays[value.index].value;
+	case JSON_OBJ:
+		return &data->objects[value.index].value;
+	default:
+		return &json_null;
+	}
+}
+
+/* builds the static data that will live at data, pointing into itself */
+template <layout L, counts C>
+consteval storage<L> build(const tree<C> & parsed, storage<L> * data) {
+	storage<L> result{};
+	std::size_t chars = 0;
+	auto copy_text = [&](text_range range) {
+		char * copy = &data->chars[chars];
+		for (std::size_t i = 0; i < range.length; i++) {
+			result.chars[chars++] = parsed.chars[range.begin + i];
+		}
+		chars++;
+		return copy;
+	};
+	for (std::size_t i = 0; i < L.numbers; i++) {
+		result.numbers[i].value.type = JSON_NUMBER;
+		result.numbers[i].number = parsed.numbers[i];
+	}
+	for (std::size_t i = 0; i < L.strings; i++) {
+		result.strings[i].value.type = JSON_STRING;
+		result.strings[i].string = copy_text(parsed.strings[i]);
+		result.strings[i].length = parsed.strings[i].length;
+	}
+	for (std::size_t i = 0; i < L.slots; i++) {
+		result.slots[i] = node(parsed.slots[i], data);
+	}
+	for (std::size_t i = 0; i < L.arrays; i++) {
+		result.arrays[i].value.type = JSON_ARRAY;
+		result.arrays[i].values = &data->slots[parsed.arrays[i].first];
+		result.arrays[i].size = parsed.arrays[i].count;
+	}
+	std::size_t keys = 0;
+	for (std::size_t i = 0; i < L.shapes; i++) {
+		const container & object = parsed.objects[parsed.shape_objects[i]];
+		result.shapes[i].keys = &data->keys[keys];
+		result.shapes[i].count = object.count;
+		result.shapes[i].refs = 1;
+		for (std::size_t j = 0; j < object.count; j++) {
+			result.keys[keys++] = copy_text(parsed.keys[object.first + j]);
+		}
+	}
+	for (std::size_t i = 0; i < L.objects; i++) {
+		result.objects[i].value.type = JSON_OBJ;
+		result.objects[i].shape = &data->shapes[parsed.objects[i].shape];
+		result.objects[i].values = &data->slots[parsed.objects[i].first];
+		result.objects[i].count = parsed.objects[i].count;
+	}
+	return result;
+}
+
+/* follows a path of keys separated by '.', where the segments index arrays as decimal numbers */
+template <counts C>
+constexpr ref find(const tree<C> & parsed, std::string_view path) {
+	ref at = parsed.root;
+	while (!path.empty()) {
+		std::size_t dot = path.find('.');
+		std::string_view segment = path.substr(0, dot);
+		path = dot == std::string_view::npos ? std::string_view() : path.substr(dot + 1);
+		if (at.type == JSON_ARRAY) {
+			std::size_t index = 0;
+			if (segment.empty()) {
+				path_not_found();
+			}
+			for (char c : segment) {
+				if (c < '0' || c > '9') {
+					path_not_found();
+				}
+				index = index * 10 + (c - '0');
+			}
+			if (index >= parsed.arrays[at.index].count) {
+				path_not_found();
+			}
+			at = parsed.slots[parsed.arrays[at.index].first + index];
+		} else if (at.type == JSON_OBJ) {
+			const container & object = parsed.objects[at.index];
+			std::size_t i = 0;
+			while (i < object.count && std::string_view(&parsed.chars[parsed.keys[object.first + i].begin], parsed.keys[object.first + i].length) != segment) {
+				i++;
+			}
+			if (i == object.count) {
+				path_not_found();
+			}
+			at = parsed.slots[object.first + i];
+		} else {
+			path_not_found();
+		}
+	}
+	return at;
+}
+
+} /* namespace detail */
+
+/*
+ * A JSON document parsed while compiling. Its values are static data,
+ * so json_free leaves them alone, and they must not be edited.
+ */
+template <literal Text>
+class document {
+	static constexpr detail::counts sizes = detail::measure(Text.view());
+	static constexpr detail::tree<sizes> parsed = detail::parse<sizes>(Text.view());
+	using storage_type = detail::storage<parsed.static_layout()>;
+	static storage_type data;
+
+	static consteval detail::ref typed(std::string_view path, JSONType type) {
+		detail::ref value = detail::find(parsed, path);
+		if (value.type != type) {
+			detail::value_has_another_type();
+		}
+		return value;
+	}
+
+public:
+	/* the whole document */
+	static constexpr const JSONValue * root() {
+		return detail::node(parsed.root, &data);
+	}
+
+	/* the value at path */
+	static consteval const JSONValue * get(std::string_view path) {
+		return detail::node(detail::find(parsed, path), &data);
+	}
+
+	static consteval JSONType type(std::string_view path) {
+		return (JSONType)detail::find(parsed, path).type;
+	}
+
+	static consteval double number(std::string_view path) {
+		return parsed.numbers[typed(path, JSON_NUMBER).index];
+	}
+
+	static consteval bool boolean(std::string_view path) {
+		return typed(path, JSON_BOOL).index != 0;
+	}
+
+	/* the contents of a string, without its terminator */
+	static consteval std::string_view string(std::string_view path) {
+		detail::text_range range = parsed.strings[typed(path, JSON_STRING).index];
+		return std::string_view(&parsed.chars[range.begin], range.length);
+	}
+
+	/* the length of an array, or the number of members of an object */
+	static consteval std::size_t size(std::string_view path) {
+		detail::ref value = detail::find(parsed, path);
+		if (value.type == JSON_ARRAY) {
+			return parsed.arrays[value.index].count;
+		}
+		if (value.type != JSON_OBJ) {
+			detail::value_has_another_type();
+		}
+		return parsed.objects[value.index].count;
+	}
+};
+
+template <literal Text>
+constinit typename document<Text>::storage_type document<Text>::data = detail::build(document<Text>::parsed, &document<Text>::data);
+
+} /* namespace json */
+
+#endif
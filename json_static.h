@@ -0,0 +1,122 @@
+#ifndef LIB_JSON_STATIC_H
+#define LIB_JSON_STATIC_H
+
+#include "json.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The layout of the values json.h keeps opaque, for building
+ * documents as static data that is ready without parsing or allocating.
+ * Each node is its own object, which the containers point to:
+ *
+ *     static JSONNumber port = JSON_STATIC_NUMBER(8080);
+ *     static JSONString host = JSON_STATIC_STRING("localhost");
+ *     static char * config_keys[] = { "host", "port", "debug" };
+ *     static JSONShape config_shape = JSON_STATIC_SHAPE(config_keys, 3);
+ *     static JSONValue * config_values[] = { JSON_STATIC_REF(host), JSON_STATIC_REF(port), JSON_STATIC_FALSE };
+ *     static JSONObject config = JSON_STATIC_OBJECT(config_shape, config_values, 3);
+ *
+ * The normal accessors work on such documents, and the fields can be read directly,
+ * e.g. port.number. Their reference counts are 0, so json_retain and json_free leave them alone.
+ */
+
+typedef struct JSONNumber JSONNumber;
+typedef struct JSONString JSONString;
+typedef struct JSONBinary JSONBinary;
+typedef struct JSONRaw JSONRaw;
+typedef struct JSONShape JSONShape;
+
+/*
+ * JSONValue is defined to just hold the type as it is
+ * not supposed to be constructed on its own, but dynamically allocated
+ * (or declared statically with the macros below)
+ * as different objects as identified by the tag, which
+ * it can then be cast to at runtime.
+ */
+struct JSONValue {
+	unsigned char type; /* a JSONType */
+	unsigned char flags; /* set by the library, e.g. when the value's source text follows it */
+	unsigned int refs; /* the number of owners, or 0 for values that are never freed */
+};
+
+struct JSONNumber {
+	JSONValue value;
+	double number;
+};
+
+struct JSONString {
+	JSONValue value;
+	char * string;
+	size_t length;
+};
+
+struct JSONBinary {
+	JSONValue value;
+	unsigned char * bytes;
+	size_t length;
+};
+
+/* text that is already serialized JSON, printed as it is */
+struct JSONRaw {
+	JSONValue value;
+	char * text;
+	size_t length;
+};
+
+struct JSONArray {
+	JSONValue value;
+	JSONValue ** values;
+	size_t size;
+};
+
+/*
+ * A JSONShape is the ordered key table of an object.
+ * Objects parsed with the same key sequence share one shape,
+ * so arrays of records only store their keys once.
+ * hint caches the slot of the last successful lookup, which makes
+ * repeated json_object_get calls on records of one shape a single comparison.
+ */
+struct JSONShape {
+	char ** keys;
+	size_t count;
+	size_t refs;
+	unsigned long hash;
+	size_t hint;
+	JSONAllocator allocator; /* which owns the shape */
+};
+
+struct JSONObject {
+	JSONValue value;
+	JSONShape * shape;
+	JSONValue ** values;
+	size_t count;
+};
+
+/* the only null, true and false values, which json_value_as_bool compares against */
+extern JSONValue json_null;
+extern JSONValue json_true;
+extern JSONValue json_false;
+
+#define JSON_STATIC_NULL (&json_null)
+#define JSON_STATIC_TRUE (&json_true)
+#define JSON_STATIC_FALSE (&json_false)
+#define JSON_STATIC_REF(node) ((JSONValue *)&(node))
+
+#define JSON_STATIC_NUMBER(number) { { JSON_NUMBER, 0, 0 }, (number) }
+/* string must be a literal or char array, as its length is taken with sizeof */
+#define JSON_STATIC_STRING(string) { { JSON_STRING, 0, 0 }, (string), sizeof(string) - 1 }
+#define JSON_STATIC_BINARY(bytes, length) { { JSON_BINARY, 0, 0 }, (bytes), (length) }
+/* text must be a literal or char array, as its length is taken with sizeof */
+#define JSON_STATIC_RAW(text) { { JSON_RAW, 0, 0 }, (text), sizeof(text) - 1 }
+#define JSON_STATIC_ARRAY(values, size) { { JSON_ARRAY, 0, 0 }, (values), (size) }
+#define JSON_STATIC_SHAPE(keys, count) { (keys), (count), 1, 0, 0, { NULL, NULL, 0, NULL } }
+#define JSON_STATIC_OBJECT(shape, values, count) { { JSON_OBJ, 0, 0 }, &(shape), (values), (count) }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,592 @@
+/*
+ * json-codegen generates a parser specialized for one JSON Schema,
+ * which reads documents straight into C structs through the JSONReader.
+ * Keys are dispatched with switches on their length and first byte,
+ * instead of building JSONObjects and searching them with json_object_get.
+ *
+ * usage: json-codegen schema.json name
+ * writes name.h and name.c, declaring
+ *     int Type_parse(const char * input, ptrdiff_t len, Type * out, JSONAllocator allocator);
+ *     void Type_free(Type * value, JSONAllocator allocator);
+ * where Type is the schema's "title", or name if it has none.
+ *
+ * The schema must describe an object. Properties may have the types
+ * "integer" (long), "number" (double), "string" (char *), "boolean" (int)
+ * or "object" (a nested struct). Members of the input that aren't properties
+ * are skipped, and the names in "required" must all be present.
+ * Keys are made into C identifiers by replacing other characters with '_', and
+ * identifiers that are keywords, "present" or already taken get a suffix such as _2.
+ */
+#include "../json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FIELDS 32 /* the bits of the present mask */
+#define MAX_STRUCTS 64
+#define MAX_NAME 256
+
+typedef enum {
+	FIELD_INTEGER,
+	FIELD_NUMBER,
+	FIELD_STRING,
+	FIELD_BOOLEAN,
+	FIELD_OBJECT
+} FieldType;
+
+typedef struct {
+	const char * key;
+	char ident[MAX_NAME];
+	FieldType type;
+	size_t object; /* index into structs, for FIELD_OBJECT */
+	int required;
+} Field;
+
+typedef struct {
+	char name[MAX_NAME];
+	Field fields[MAX_FIELDS];
+	size_t count;
+} Struct;
+
+static Struct structs[MAX_STRUCTS];
+static size_t struct_count;
+
+static void fail(const char * message, const char * detail) {
+	fprintf(stderr, "json-codegen: %s%s\n", message, detail);
+	exit(1);
+}
+
+static char * read_file(const char * path) {
+	FILE * file = fopen(path, "rb");
+	char * contents = NULL;
+	size_t size = 0;
+	size_t capacity = 0;
+	size_t read;
+	if (!file) {
+		fail("can't open ", path);
+	}
+	do {
+		if (size + 4096 + 1 > capacity) {
+			capacity = capacity ? capacity * 2 : 8192;
+			contents = realloc(contents, capacity);
+			if (!contents) {
+				fail("out of memory reading ", path);
+			}
+		}
+		read = fread(contents + size, 1, capacity - size - 1, file);
+		size += read;
+	} while (read > 0);
+	fclose(file);
+	contents[size] = '\0';
+	return contents;
+}
+
+/* the keywords of C up to C23, which can't name fields or types */
+static const char * const keywords[] = {
+	"auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum",
+	"extern", "float", "for", "goto", "if", "int", "long", "register", "return", "short", "signed",
+	"sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while",
+	"inline", "restrict", "_Bool", "_Complex", "_Imaginary", "_Alignas", "_Alignof", "_Atomic",
+	"_Generic", "_Noreturn", "_Static_assert", "_Thread_local", "alignas", "alignof", "bool",
+	"constexpr", "false", "nullptr", "static_assert", "thread_local", "true", "typeof", "typeof_unqual"
+};
+
+/* the functions generated for each struct are named by the struct and one of these */
+static const char * const function_suffixes[] = { "_init", "_free", "_read", "_parse" };
+
+static int is_keyword(const char * ident) {
+	size_t i;
+	for (i = 0; i < sizeof(keywords) / sizeof(*keywords); i++) {
+		if (strcmp(ident, keywords[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* whether a field of s other than the last one added, or the present mask, is named ident */
+static int field_taken(const char * ident, const Struct * s) {
+	size_t i;
+	if (is_keyword(ident) || strcmp(ident, "present") == 0) {
+		return 1;
+	}
+	for (i = 0; i + 1 < s->count; i++) {
+		if (strcmp(ident, s->fields[i].ident) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* whether name is prefix followed by one of function_suffixes */
+static int is_function_of(const char * name, const char * prefix) {
+	size_t len = strlen(prefix);
+	size_t i;
+	if (strncmp(name, prefix, len) != 0) {
+		return 0;
+	}
+	for (i = 0; i < sizeof(function_suffixes) / sizeof(*function_suffixes); i++) {
+		if (strcmp(name + len, function_suffixes[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* whether name is taken by another struct than the last one added, its functions or read_string */
+static int struct_taken(const char * name) {
+	size_t i;
+	if (is_keyword(name) || strcmp(name, "read_string") == 0) {
+		return 1;
+	}
+	for (i = 0; i + 1 < struct_count; i++) {
+		if (strcmp(name, structs[i].name) == 0 || is_function_of(name, structs[i].name) || is_function_of(structs[i].name, name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* makes a C identifier out of a key */
+static void to_ident(char * ident, const char * key) {
+	size_t i;
+	/* leaving room for a suffix */
+	for (i = 0; key[i] && i + 1 < MAX_NAME - 16; i++) {
+		char c = key[i];
+		int alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+		int digit = c >= '0' && c <= '9';
+		ident[i] = alpha || (digit && i > 0) ? c : '_';
+	}
+	ident[i] = '\0';
+	if (i == 0) {
+		strcpy(ident, "_");
+	}
+}
+
+/* appends _2, _3 and so on to ident until it isn't taken */
+static void field_ident(char * ident, const char * key, const Struct * s) {
+	size_t len;
+	unsigned long n = 2;
+	to_ident(ident, key);
+	len = strlen(ident);
+	while (field_taken(ident, s)) {
+		sprintf(ident + len, "_%lu", n++);
+	}
+}
+
+static void struct_name(char * name, const char * key) {
+	size_t len;
+	unsigned long n = 2;
+	to_ident(name, key);
+	len = strlen(name);
+	while (struct_taken(name)) {
+		sprintf(name + len, "_%lu", n++);
+	}
+}
+
+static const char * schema_type(const JSONValue * schema) {
+	const JSONValue * type;
+	if (json_value_type(schema) != JSON_OBJ) {
+		fail("a schema must be an object", "");
+	}
+	type = json_object_get(json_value_as_object(schema), "type");
+	if (type && json_value_type(type) == JSON_ARRAY) {
+		/* e.g. ["string", "null"], null is always accepted anyway */
+		const JSONArray * types = json_value_as_array(type);
+		size_t i;
+		for (i = 0; i < json_array_length(types); i++) {
+			const JSONValue * t = json_array_index(types, i);
+			if (json_value_type(t) == JSON_STRING && strcmp(json_value_as_string(t), "null") != 0) {
+				return json_value_as_string(t);
+			}
+		}
+		fail("a type list needs a type other than null", "");
+	}
+	if (!type || json_value_type(type) != JSON_STRING) {
+		fail("a schema needs a type", "");
+	}
+	return json_value_as_string(type);
+}
+
+static size_t add_struct(const JSONValue * schema, const char * name) {
+	const JSONObject * obj;
+	const JSONValue * properties;
+	const JSONValue * required;
+	Struct * s;
+	size_t index;
+	size_t i;
+	if (strcmp(schema_type(schema), "object") != 0) {
+		fail("expected an object schema for ", name);
+	}
+	if (struct_count == MAX_STRUCTS) {
+		fail("too many nested objects at ", name);
+	}
+	index = struct_count++;
+	s = &structs[index];
+	struct_name(s->name, name);
+	obj = json_value_as_object(schema);
+	properties = json_object_get(obj, "properties");
+	if (!properties || json_value_type(properties) != JSON_OBJ) {
+		fail("missing properties in ", name);
+	}
+	if (json_object_count(json_value_as_object(properties)) > MAX_FIELDS) {
+		fail("too many properties in ", name);
+	}
+	for (i = 0; i < json_object_count(json_value_as_object(properties)); i++) {
+		const JSONObject * props = json_value_as_object(properties);
+		const JSONValue * property = json_object_index(props, i);
+		const char * type = schema_type(property);
+		Field * field = &s->fields[s->count++];
+		field->key = json_object_index_keys(props, i);
+		field_ident(field->ident, field->key, s);
+		field->required = 0;
+		if (strcmp(type, "integer") == 0) {
+			field->type = FIELD_INTEGER;
+		} else if (strcmp(type, "number") == 0) {
+			field->type = FIELD_NUMBER;
+		} else if (strcmp(type, "string") == 0) {
+			field->type = FIELD_STRING;
+		} else if (strcmp(type, "boolean") == 0) {
+			field->type = FIELD_BOOLEAN;
+		} else if (strcmp(type, "object") == 0) {
+			char nested[MAX_NAME];
+			if (strlen(s->name) + strlen(field->ident) + 2 >= MAX_NAME - 16) {
+				fail("name too long at ", field->key);
+			}
+			strcpy(nested, s->name);
+			strcat(nested, "_");
+			strcat(nested, field->ident);
+			field->type = FIELD_OBJECT;
+			field->object = add_struct(property, nested);
+			s = &structs[index];
+		} else {
+			fail("unsupported type ", type);
+		}
+	}
+	required = json_object_get(obj, "required");
+	if (required && json_value_type(required) == JSON_ARRAY) {
+		const JSONArray * names = json_value_as_array(required);
+		for (i = 0; i < json_array_length(names); i++) {
+			const JSONValue * name = json_array_index(names, i);
+			size_t j;
+			for (j = 0; j < s->count; j++) {
+				if (json_value_type(name) == JSON_STRING && strcmp(json_value_as_string(name), s->fields[j].key) == 0) {
+					s->fields[j].required = 1;
+				}
+			}
+		}
+	}
+	return index;
+}
+
+/* writes bytes as the contents of a C string literal */
+static void write_literal(FILE * out, const char * bytes, size_t len) {
+	size_t i;
+	for (i = 0; i < len; i++) {
+		unsigned char c = bytes[i];
+		if (c == '"' || c == '\\') {
+			fprintf(out, "\\%c", c);
+		} else if (c >= 0x20 && c < 0x7F && c != '?') {
+			fputc(c, out);
+		} else {
+			/* octal escapes can't swallow the characters after them like hex ones */
+			fprintf(out, "\\%03o", c);
+		}
+	}
+}
+
+static void write_header(FILE * out, const char * guard, size_t root) {
+	size_t i;
+	size_t j;
+	fprintf(out, "/* generated by json-codegen, do not edit */\n");
+	fprintf(out, "#ifndef %s_H\n#define %s_H\n\n#include \"json.h\"\n\n", guard, guard);
+	/* nested structs are added after their parents, so they are declared in reverse */
+	for (i = struct_count; i-- > 0;) {
+		const Struct * s = &structs[i];
+		fprintf(out, "typedef struct %s {\n", s->name);
+		for (j = 0; j < s->count; j++) {
+			const Field * field = &s->fields[j];
+			switch (field->type) {
+			case FIELD_INTEGER:
+				fprintf(out, "\tlong %s;\n", field->ident);
+				break;
+			case FIELD_NUMBER:
+				fprintf(out, "\tdouble %s;\n", field->ident);
+				break;
+			case FIELD_STRING:
+				fprintf(out, "\tchar * %s;\n", field->ident);
+				break;
+			case FIELD_BOOLEAN:
+				fprintf(out, "\tint %s;\n", field->ident);
+				break;
+			case FIELD_OBJECT:
+				fprintf(out, "\t%s %s;\n", structs[field->object].name, field->ident);
+				break;
+			}
+		}
+		fprintf(out, "\tunsigned long present; /* bit i is set when the i-th field was in the input */\n");
+		fprintf(out, "} %s;\n\n", s->name);
+	}
+	fprintf(out, "int %s_parse(const char * input, ptrdiff_t len, %s * out, JSONAllocator allocator);\n", structs[root].name, structs[root].name);
+	fprintf(out, "void %s_free(%s * value, JSONAllocator allocator);\n\n#endif\n", structs[root].name, structs[root].name);
+}
+
+static void write_field(FILE * out, const Struct * s, size_t index, const char * indent) {
+	const Field * field = &s->fields[index];
+	fprintf(out, "%sif (value.type == JSON_TOKEN_NULL) {\n%s\tgoto next;\n%s}\n", indent, indent, indent);
+	switch (field->type) {
+	case FIELD_INTEGER:
+		fprintf(out, "%sif (!json_token_integer(&value, &out->%s)) {\n%s\treturn 0;\n%s}\n", indent, field->ident, indent, indent);
+		break;
+	case FIELD_NUMBER:
+		fprintf(out, "%sif (!json_token_number(&value, &out->%s)) {\n%s\treturn 0;\n%s}\n", indent, field->ident, indent, indent);
+		break;
+	case FIELD_STRING:
+		fprintf(out, "%sif (!read_string(&value, &out->%s, allocator)) {\n%s\treturn 0;\n%s}\n", indent, field->ident, indent, indent);
+		break;
+	case FIELD_BOOLEAN:
+		fprintf(out, "%sif (value.type != JSON_TOKEN_TRUE && value.type != JSON_TOKEN_FALSE) {\n%s\treturn 0;\n%s}\n", indent, indent, indent);
+		fprintf(out, "%sout->%s = value.type == JSON_TOKEN_TRUE;\n", indent, field->ident);
+		break;
+	case FIELD_OBJECT:
+		fprintf(out, "%s%s_free(&out->%s, allocator);\n", indent, structs[field->object].name, field->ident);
+		fprintf(out, "%sif (!%s_read(reader, &value, &out->%s, allocator)) {\n%s\treturn 0;\n%s}\n", indent, structs[field->object].name, field->ident, indent, indent);
+		break;
+	}
+	fprintf(out, "%sout->present |= 1UL << %lu;\n%sgoto next;\n", indent, (unsigned long)index, indent);
+}
+
+static void write_dispatch(FILE * out, const Struct * s) {
+	size_t lengths[MAX_FIELDS];
+	size_t length_count = 0;
+	size_t i;
+	size_t j;
+	size_t k;
+	for (i = 0; i < s->count; i++) {
+		size_t len = strlen(s->fields[i].key);
+		for (j = 0; j < length_count && lengths[j] != len; j++);
+		if (j == length_count) {
+			lengths[length_count++] = len;
+		}
+	}
+	fprintf(out, "\t\tswitch (n) {\n");
+	for (i = 0; i < length_count; i++) {
+		size_t len = lengths[i];
+		unsigned char firsts[MAX_FIELDS];
+		size_t first_count = 0;
+		fprintf(out, "\t\tcase %lu:\n", (unsigned long)len);
+		if (len == 0) {
+			for (j = 0; j < s->count; j++) {
+				if (strlen(s->fields[j].key) == 0) {
+					write_field(out, s, j, "\t\t\t");
+				}
+			}
+			continue;
+		}
+		for (j = 0; j < s->count; j++) {
+			unsigned char first = s->fields[j].key[0];
+			if (strlen(s->fields[j].key) != len) {
+				continue;
+			}
+			for (k = 0; k < first_count && firsts[k] != first; k++);
+			if (k == first_count) {
+				firsts[first_count++] = first;
+			}
+		}
+		fprintf(out, "\t\t\tswitch ((unsigned char)k[0]) {\n");
+		for (k = 0; k < first_count; k++) {
+			fprintf(out, "\t\t\tcase %u:\n", firsts[k]);
+			for (j = 0; j < s->count; j++) {
+				const char * key = s->fields[j].key;
+				if (strlen(key) != len || (unsigned char)key[0] != firsts[k]) {
+					continue;
+				}
+				if (len > 1) {
+					fprintf(out, "\t\t\t\tif (memcmp(k + 1, \"");
+					write_literal(out, key + 1, len - 1);
+					fprintf(out, "\", %lu) == 0) {\n", (unsigned long)(len - 1));
+					write_field(out, s, j, "\t\t\t\t\t");
+					fprintf(out, "\t\t\t\t}\n");
+				} else {
+					write_field(out, s, j, "\t\t\t\t");
+				}
+			}
+			fprintf(out, "\t\t\t\tbreak;\n");
+		}
+		fprintf(out, "\t\t\t}\n\t\t\tbreak;\n");
+	}
+	fprintf(out, "\t\t}\n");
+}
+
+static void write_struct(FILE * out, size_t index) {
+	const Struct * s = &structs[index];
+	unsigned long required = 0;
+	size_t max_key = 0;
+	size_t i;
+	for (i = 0; i < s->count; i++) {
+		if (s->fields[i].required) {
+			required |= 1UL << i;
+		}
+		if (strlen(s->fields[i].key) > max_key) {
+			max_key = strlen(s->fields[i].key);
+		}
+	}
+	fprintf(out, "static void %s_init(%s * out) {\n", s->name, s->name);
+	for (i = 0; i < s->count; i++) {
+		const Field * field = &s->fields[i];
+		switch (field->type) {
+		case FIELD_STRING:
+			fprintf(out, "\tout->%s = NULL;\n", field->ident);
+			break;
+		case FIELD_OBJECT:
+			fprintf(out, "\t%s_init(&out->%s);\n", structs[field->object].name, field->ident);
+			break;
+		default:
+			fprintf(out, "\tout->%s = 0;\n", field->ident);
+			break;
+		}
+	}
+	fprintf(out, "\tout->present = 0;\n}\n\n");
+
+	fprintf(out, "%svoid %s_free(%s * value, JSONAllocator allocator) {\n", index == 0 ? "" : "static ", s->name, s->name);
+	/* structs without strings or nested objects don't use it */
+	fprintf(out, "\t(void)allocator;\n");
+	for (i = 0; i < s->count; i++) {
+		const Field * field = &s->fields[i];
+		if (field->type == FIELD_STRING) {
+			fprintf(out, "\tif (value->%s) {\n", field->ident);
+			fprintf(out, "\t\tallocator.callback(allocator.ctx, value->%s, strlen(value->%s) + 1, 0);\n\t}\n", field->ident, field->ident);
+		} else if (field->type == FIELD_OBJECT) {
+			fprintf(out, "\t%s_free(&value->%s, allocator);\n", structs[field->object].name, field->ident);
+		}
+	}
+	fprintf(out, "\t%s_init(value);\n}\n\n", s->name);
+
+	fprintf(out, "static int %s_read(JSONReader * reader, const JSONToken * first, %s * out, JSONAllocator allocator) {\n", s->name, s->name);
+	/* an escaped key decodes to at least a sixth of its length, so longer ones can't match */
+	fprintf(out, "\tchar buffer[%lu];\n", (unsigned long)(max_key * 6 + 1));
+	fprintf(out, "\tJSONToken key;\n\tJSONToken value;\n\tconst char * k;\n\tsize_t n;\n");
+	fprintf(out, "\t(void)allocator;\n");
+	fprintf(out, "\tif (first->type != JSON_TOKEN_BEGIN_OBJECT) {\n\t\treturn 0;\n\t}\n");
+	fprintf(out, "\tfor (;;) {\n");
+	fprintf(out, "\t\tkey = json_reader_next(reader);\n");
+	fprintf(out, "\t\tif (key.type == JSON_TOKEN_END_OBJECT) {\n\t\t\tbreak;\n\t\t}\n");
+	fprintf(out, "\t\tif (key.type != JSON_TOKEN_STRING || json_reader_next(reader).type != JSON_TOKEN_COLON) {\n\t\t\treturn 0;\n\t\t}\n");
+	fprintf(out, "\t\tvalue = json_reader_next(reader);\n");
+	fprintf(out, "\t\tk = key.begin;\n\t\tn = key.end - key.begin;\n");
+	fprintf(out, "\t\tif (key.escaped) {\n");
+	fprintf(out, "\t\t\tif (n >= sizeof(buffer)) {\n\t\t\t\tgoto skip;\n\t\t\t}\n");
+	fprintf(out, "\t\t\tn = json_token_string(&key, buffer);\n");
+	fprintf(out, "\t\t\tif (n == (size_t)-1) {\n\t\t\t\treturn 0;\n\t\t\t}\n");
+	fprintf(out, "\t\t\tk = buffer;\n\t\t}\n");
+	write_dispatch(out, s);
+	fprintf(out, "skip:\n");
+	fprintf(out, "\t\tif (!json_reader_skip(reader, &value)) {\n\t\t\treturn 0;\n\t\t}\n\t\tgoto next;\n");
+	fprintf(out, "next:\n");
+	fprintf(out, "\t\tvalue = json_reader_next(reader);\n");
+	fprintf(out, "\t\tif (value.type == JSON_TOKEN_END_OBJECT) {\n\t\t\tbreak;\n\t\t}\n");
+	fprintf(out, "\t\tif (value.type != JSON_TOKEN_COMMA) {\n\t\t\treturn 0;\n\t\t}\n");
+	fprintf(out, "\t}\n");
+	fprintf(out, "\treturn (out->present & 0x%lXUL) == 0x%lXUL;\n}\n\n", required, required);
+}
+
+static int has_strings(void) {
+	size_t i;
+	size_t j;
+	for (i = 0; i < struct_count; i++) {
+		for (j = 0; j < structs[i].count; j++) {
+			if (structs[i].fields[j].type == FIELD_STRING) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void write_read_string(FILE * out) {
+	fprintf(out, "static int read_string(const JSONToken * token, char ** out, JSONAllocator allocator) {\n");
+	fprintf(out, "\tsize_t capacity = token->end - token->begin + 1;\n");
+	fprintf(out, "\tchar * string;\n\tsize_t length;\n");
+	fprintf(out, "\tif (token->type != JSON_TOKEN_STRING) {\n\t\treturn 0;\n\t}\n");
+	fprintf(out, "\tstring = allocator.callback(allocator.ctx, NULL, 0, capacity);\n");
+	fprintf(out, "\tif (!string) {\n\t\treturn 0;\n\t}\n");
+	fprintf(out, "\tlength = json_token_string(token, string);\n");
+	fprintf(out, "\tif (length == (size_t)-1) {\n\t\tallocator.callback(allocator.ctx, string, capacity, 0);\n\t\treturn 0;\n\t}\n");
+	fprintf(out, "\tif (length + 1 < capacity) {\n");
+	fprintf(out, "\t\t/* shrunk so that the size can be recovered with strlen when freeing */\n");
+	fprintf(out, "\t\tchar * shrunk = allocator.callback(allocator.ctx, string, capacity, length + 1);\n");
+	fprintf(out, "\t\tif (!shrunk) {\n\t\t\tallocator.callback(allocator.ctx, string, capacity, 0);\n\t\t\treturn 0;\n\t\t}\n");
+	fprintf(out, "\t\tstring = shrunk;\n\t}\n");
+	fprintf(out, "\tif (*out) {\n\t\tallocator.callback(allocator.ctx, *out, strlen(*out) + 1, 0);\n\t}\n");
+	fprintf(out, "\t*out = string;\n\treturn 1;\n}\n\n");
+}
+
+static void write_source(FILE * out, const char * header) {
+	size_t i;
+	fprintf(out, "/* generated by json-codegen, do not edit */\n");
+	fprintf(out, "#include \"%s\"\n#include <string.h>\n\n", header);
+	if (has_strings()) {
+		write_read_string(out);
+	}
+	/* nested structs are added after their parents, so their functions are defined first */
+	for (i = struct_count; i-- > 0;) {
+		write_struct(out, i);
+	}
+	fprintf(out, "int %s_parse(const char * input, ptrdiff_t len, %s * out, JSONAllocator allocator) {\n", structs[0].name, structs[0].name);
+	fprintf(out, "\tJSONReader reader = json_reader_new(input, len);\n");
+	fprintf(out, "\tJSONToken first = json_reader_next(&reader);\n");
+	fprintf(out, "\t%s_init(out);\n", structs[0].name);
+	fprintf(out, "\tif (!%s_read(&reader, &first, out, allocator) || json_reader_next(&reader).type != JSON_TOKEN_EOF) {\n", structs[0].name);
+	fprintf(out, "\t\t%s_free(out, allocator);\n\t\treturn 0;\n\t}\n\treturn 1;\n}\n", structs[0].name);
+}
+
+int main(int argc, char ** argv) {
+	JSONAllocator allocator = json_default_allocator();
+	JSONValue * schema;
+	const JSONValue * title;
+	char * text;
+	char path[MAX_NAME + 3];
+	char guard[MAX_NAME];
+	const char * base;
+	FILE * out;
+	size_t i;
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s schema.json name\n", argv[0]);
+		return 1;
+	}
+	if (strlen(argv[2]) >= MAX_NAME) {
+		fail("name too long: ", argv[2]);
+	}
+	text = read_file(argv[1]);
+	schema = json_parse(text, -1, allocator);
+	if (!schema) {
+		fail("invalid JSON in ", argv[1]);
+	}
+	base = strrchr(argv[2], '/') ? strrchr(argv[2], '/') + 1 : argv[2];
+	title = json_value_type(schema) == JSON_OBJ ? json_object_get(json_value_as_object(schema), "title") : NULL;
+	add_struct(schema, title && json_value_type(title) == JSON_STRING ? json_value_as_string(title) : base);
+	to_ident(guard, base);
+	for (i = 0; guard[i]; i++) {
+		if (guard[i] >= 'a' && guard[i] <= 'z') {
+			guard[i] = guard[i] - 'a' + 'A';
+		}
+	}
+	sprintf(path, "%s.h", argv[2]);
+	out = fopen(path, "w");
+	if (!out) {
+		fail("can't write ", path);
+	}
+	write_header(out, guard, 0);
+	fclose(out);
+	sprintf(path, "%s.c", argv[2]);
+	out = fopen(path, "w");
+	if (!out) {
+		fail("can't write ", path);
+	}
+	sprintf(path, "%s.h", base);
+	write_source(out, path);
+	fclose(out);
+	json_free(schema, allocator);
+	free(text);
+	return 0;
+}
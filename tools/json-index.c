@@ -0,0 +1,161 @@
+/*
+ * json-index builds a sidecar index of a large JSON array or newline delimited
+ * JSON file, and uses it to print single elements without reading the rest.
+ *
+ * usage: json-index [-r] [-k key.path] input.json
+ *     writes input.json.idx, indexing the elements of the array in input.json,
+ *     or its records with -r, and with -k the value at key.path in each of them
+ * usage: json-index -n N input.json
+ *        json-index -f key input.json
+ *     prints the Nth element, or the first one whose key is key, using input.json.idx
+ *
+ * The input is mapped into memory where mmap is available, so only the pages
+ * of the elements printed are read.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200112L
+#define INDEX_USE_MMAP
+#endif
+#include "../json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef INDEX_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define MAX_PATH 4096
+
+static void fail(const char * message, const char * detail) {
+	fprintf(stderr, "json-index: %s%s\n", message, detail);
+	exit(1);
+}
+
+#ifdef INDEX_USE_MMAP
+static const char * map_file(const char * path, size_t * size) {
+	struct stat st;
+	void * data;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fail("can't open ", path);
+	}
+	*size = st.st_size;
+	if (*size == 0) {
+		close(fd);
+		return "";
+	}
+	data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fail("can't map ", path);
+	}
+	return data;
+}
+#else
+static const char * map_file(const char * path, size_t * size) {
+	FILE * file = fopen(path, "rb");
+	char * contents = NULL;
+	size_t capacity = 0;
+	size_t read;
+	*size = 0;
+	if (!file) {
+		fail("can't open ", path);
+	}
+	do {
+		if (*size + 4096 > capacity) {
+			capacity = capacity ? capacity * 2 : 8192;
+			contents = realloc(contents, capacity);
+			if (!contents) {
+				fail("out of memory reading ", path);
+			}
+		}
+		read = fread(contents + *size, 1, capacity - *size, file);
+		*size += read;
+	} while (read > 0);
+	fclose(file);
+	return contents;
+}
+#endif
+
+static void usage(const char * name) {
+	fprintf(stderr, "usage: %s [-r] [-k key.path] input.json\n", name);
+	fprintf(stderr, "       %s -n N input.json\n", name);
+	fprintf(stderr, "       %s -f key input.json\n", name);
+	exit(1);
+}
+
+int main(int argc, char ** argv) {
+	JSONAllocator allocator = json_default_allocator();
+	JSONIndexLayout layout = JSON_INDEX_ARRAY;
+	const char * key_path = NULL;
+	const char * nth = NULL;
+	const char * key = NULL;
+	const char * input_path;
+	const char * input;
+	char index_path[MAX_PATH];
+	JSONIndex * index;
+	FILE * file;
+	size_t size;
+	int i;
+	for (i = 1; i < argc - 1; i++) {
+		if (strcmp(argv[i], "-r") == 0) {
+			layout = JSON_INDEX_RECORDS;
+		} else if (strcmp(argv[i], "-k") == 0 && i + 2 < argc) {
+			key_path = argv[++i];
+		} else if (strcmp(argv[i], "-n") == 0 && i + 2 < argc) {
+			nth = argv[++i];
+		} else if (strcmp(argv[i], "-f") == 0 && i + 2 < argc) {
+			key = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (i != argc - 1 || (nth && key)) {
+		usage(argv[0]);
+	}
+	input_path = argv[i];
+	if (strlen(input_path) + sizeof(".idx") > MAX_PATH) {
+		fail("path too long: ", input_path);
+	}
+	sprintf(index_path, "%s.idx", input_path);
+	input = map_file(input_path, &size);
+	if (!nth && !key) {
+		index = json_index_build(input, size, layout, key_path, allocator);
+		if (!index) {
+			fail("invalid JSON in ", input_path);
+		}
+		file = fopen(index_path, "wb");
+		if (!file || json_index_write(index, file) || fclose(file) != 0) {
+			fail("can't write ", index_path);
+		}
+		printf("%lu elements\n", (unsigned long)json_index_count(index));
+	} else {
+		size_t offset;
+		size_t length;
+		int found;
+		file = fopen(index_path, "rb");
+		if (!file) {
+			fail("can't open ", index_path);
+		}
+		index = json_index_read(file, size, allocator);
+		fclose(file);
+		if (!index) {
+			fail("invalid or stale index ", index_path);
+		}
+		if (nth) {
+			found = json_index_element(index, size, strtoul(nth, NULL, 10), &offset, &length);
+		} else {
+			found = json_index_find(index, input, size, key, &offset, &length);
+		}
+		if (!found) {
+			fail("no such element: ", nth ? nth : key);
+		}
+		fwrite(input + offset, 1, length, stdout);
+		putchar('\n');
+	}
+	json_index_free(index);
+	return 0;
+}
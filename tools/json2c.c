@@ -0,0 +1,293 @@
+/*
+ * json2c turns a JSON file into C source declaring it as static data with
+ * the macros of json_static.h, so it is ready at startup without parsing or allocating.
+ *
+ * usage: json2c input.json name
+ * writes name.h and name.c, declaring
+ *     extern const JSONValue * const name;
+ * Objects that share keys in the input share one static shape, as they would when parsed.
+ */
+#include "../json.h"
+#include "../json_static.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_NAME 256
+
+static FILE * out;
+static char prefix[MAX_NAME];
+static unsigned long node_count;
+
+/* the shapes written so far, and the numbers of their declarations */
+static const JSONShape ** shapes;
+static unsigned long * shape_ids;
+static size_t shape_count;
+static size_t shape_capacity;
+
+static void fail(const char * message, const char * detail) {
+	fprintf(stderr, "json2c: %s%s\n", message, detail);
+	exit(1);
+}
+
+static char * read_file(const char * path, size_t * size) {
+	FILE * file = fopen(path, "rb");
+	char * contents = NULL;
+	size_t capacity = 0;
+	size_t read;
+	*size = 0;
+	if (!file) {
+		fail("can't open ", path);
+	}
+	do {
+		if (*size + 4096 + 1 > capacity) {
+			capacity = capacity ? capacity * 2 : 8192;
+			contents = realloc(contents, capacity);
+			if (!contents) {
+				fail("out of memory reading ", path);
+			}
+		}
+		read = fread(contents + *size, 1, capacity - *size - 1, file);
+		*size += read;
+	} while (read > 0);
+	fclose(file);
+	contents[*size] = '\0';
+	return contents;
+}
+
+/*
+ * writes number as a floating literal, so that it keeps its type and
+ * sign in C: %.17g prints -0.0 as -0, which C reads as the integer 0
+ */
+static void write_number(double number) {
+	char buffer[32];
+	sprintf(buffer, "%.17g", number);
+	if (!strpbrk(buffer, ".eEin")) {
+		strcat(buffer, ".0");
+	}
+	fputs(buffer, out);
+}
+
+static void write_literal(const char * bytes, size_t len) {
+	size_t i;
+	fputc('"', out);
+	for (i = 0; i < len; i++) {
+		unsigned char c = bytes[i];
+		if (c == '"' || c == '\\') {
+			fprintf(out, "\\%c", c);
+		} else if (c >= 0x20 && c < 0x7F && c != '?') {
+			fputc(c, out);
+		} else {
+			/* octal escapes can't swallow the characters after them like hex ones */
+			fprintf(out, "\\%03o", c);
+		}
+	}
+	fputc('"', out);
+}
+
+static unsigned long write_shape(const JSONShape * shape) {
+	unsigned long id;
+	size_t i;
+	for (i = 0; i < shape_count; i++) {
+		if (shapes[i] == shape) {
+			return shape_ids[i];
+		}
+	}
+	id = node_count++;
+	if (shape->count > 0) {
+		fprintf(out, "static char * %s_%lu_keys[] = {\n", prefix, id);
+		for (i = 0; i < shape->count; i++) {
+			fputc('\t', out);
+			write_literal(shape->keys[i], strlen(shape->keys[i]));
+			fputs(i + 1 < shape->count ? ",\n" : "\n", out);
+		}
+		fprintf(out, "};\n");
+		fprintf(out, "static JSONShape %s_%lu = JSON_STATIC_SHAPE(%s_%lu_keys, %lu);\n", prefix, id, prefix, id, (unsigned long)shape->count);
+	} else {
+		fprintf(out, "static JSONShape %s_%lu = JSON_STATIC_SHAPE(NULL, 0);\n", prefix, id);
+	}
+	if (shape_count == shape_capacity) {
+		shape_capacity = shape_capacity ? shape_capacity * 2 : 64;
+		shapes = realloc(shapes, shape_capacity * sizeof(*shapes));
+		shape_ids = realloc(shape_ids, shape_capacity * sizeof(*shape_ids));
+		if (!shapes || !shape_ids) {
+			fail("out of memory", "");
+		}
+	}
+	shapes[shape_count] = shape;
+	shape_ids[shape_count] = id;
+	++shape_count;
+	return id;
+}
+
+/* node numbers standing for the singletons */
+#define REF_NULL ((unsigned long)-1)
+#define REF_TRUE ((unsigned long)-2)
+#define REF_FALSE ((unsigned long)-3)
+
+static void write_ref(unsigned long id) {
+	switch (id) {
+	case REF_NULL:
+		fputs("JSON_STATIC_NULL", out);
+		break;
+	case REF_TRUE:
+		fputs("JSON_STATIC_TRUE", out);
+		break;
+	case REF_FALSE:
+		fputs("JSON_STATIC_FALSE", out);
+		break;
+	default:
+		fprintf(out, "JSON_STATIC_REF(%s_%lu)", prefix, id);
+		break;
+	}
+}
+
+/* writes the declaration of value after those of everything it holds, returning its node number */
+static unsigned long write_value(const JSONValue * value) {
+	unsigned long id;
+	unsigned long * refs = NULL;
+	size_t count = 0;
+	size_t i;
+	JSONValue * const * values = NULL;
+	switch (json_value_type(value)) {
+	case JSON_NULL:
+		return REF_NULL;
+	case JSON_BOOL:
+		return json_value_as_bool(value) ? REF_TRUE : REF_FALSE;
+	case JSON_ARRAY:
+		values = ((const JSONArray *)value)->values;
+		count = ((const JSONArray *)value)->size;
+		break;
+	case JSON_OBJ:
+		values = ((const JSONObject *)value)->values;
+		count = ((const JSONObject *)value)->count;
+		break;
+	default:
+		break;
+	}
+	if (count > 0) {
+		refs = malloc(count * sizeof(*refs));
+		if (!refs) {
+			fail("out of memory", "");
+		}
+		for (i = 0; i < count; i++) {
+			refs[i] = write_value(values[i]);
+		}
+	}
+	id = node_count++;
+	switch (json_value_type(value)) {
+	case JSON_NUMBER:
+		fprintf(out, "static JSONNumber %s_%lu = JSON_STATIC_NUMBER(", prefix, id);
+		write_number(json_value_as_number(value));
+		fprintf(out, ");\n");
+		break;
+	case JSON_STRING:
+		fprintf(out, "static JSONString %s_%lu = JSON_STATIC_STRING(", prefix, id);
+		write_literal(((const JSONString *)value)->string, ((const JSONString *)value)->length);
+		fprintf(out, ");\n");
+		break;
+	case JSON_RAW:
+		fprintf(out, "static JSONRaw %s_%lu = JSON_STATIC_RAW(", prefix, id);
+		write_literal(((const JSONRaw *)value)->text, ((const JSONRaw *)value)->length);
+		fprintf(out, ");\n");
+		break;
+	case JSON_BINARY: {
+		const JSONBinary * binary = (const JSONBinary *)value;
+		fprintf(out, "static unsigned char %s_%lu_bytes[] = {", prefix, id);
+		for (i = 0; i < binary->length; i++) {
+			fprintf(out, i % 16 ? " %u," : "\n\t%u,", binary->bytes[i]);
+		}
+		fprintf(out, "\n\t0\n};\n");
+		fprintf(out, "static JSONBinary %s_%lu = JSON_STATIC_BINARY(%s_%lu_bytes, %lu);\n", prefix, id, prefix, id, (unsigned long)binary->length);
+		break;
+	}
+	case JSON_ARRAY:
+	case JSON_OBJ: {
+		unsigned long shape = 0;
+		if (json_value_type(value) == JSON_OBJ) {
+			shape = write_shape(((const JSONObject *)value)->shape);
+		}
+		if (count > 0) {
+			fprintf(out, "static JSONValue * %s_%lu_values[] = {\n", prefix, id);
+			for (i = 0; i < count; i++) {
+				fputc('\t', out);
+				write_ref(refs[i]);
+				fputs(i + 1 < count ? ",\n" : "\n", out);
+			}
+			fprintf(out, "};\n");
+		}
+		if (json_value_type(value) == JSON_ARRAY) {
+			fprintf(out, "static JSONArray %s_%lu = JSON_STATIC_ARRAY(", prefix, id);
+		} else {
+			fprintf(out, "static JSONObject %s_%lu = JSON_STATIC_OBJECT(%s_%lu, ", prefix, id, prefix, shape);
+		}
+		if (count > 0) {
+			fprintf(out, "%s_%lu_values, %lu);\n", prefix, id, (unsigned long)count);
+		} else {
+			fprintf(out, "NULL, 0);\n");
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	free(refs);
+	return id;
+}
+
+int main(int argc, char ** argv) {
+	JSONAllocator allocator = json_default_allocator();
+	JSONValue * value;
+	char * text;
+	size_t size;
+	char path[MAX_NAME + 3];
+	unsigned long root;
+	const char * base;
+	size_t i;
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s input.json name\n", argv[0]);
+		return 1;
+	}
+	if (strlen(argv[2]) >= MAX_NAME - 32) {
+		fail("name too long: ", argv[2]);
+	}
+	base = strrchr(argv[2], '/') ? strrchr(argv[2], '/') + 1 : argv[2];
+	for (i = 0; base[i]; i++) {
+		char c = base[i];
+		int alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+		prefix[i] = alpha || (c >= '0' && c <= '9' && i > 0) ? c : '_';
+	}
+	prefix[i] = '\0';
+	text = read_file(argv[1], &size);
+	value = json_parse(text, size, allocator);
+	if (!value) {
+		fail("invalid JSON in ", argv[1]);
+	}
+	sprintf(path, "%s.h", argv[2]);
+	out = fopen(path, "w");
+	if (!out) {
+		fail("can't write ", path);
+	}
+	fprintf(out, "/* generated by json2c, do not edit */\n#ifndef %s_JSON_H\n#define %s_JSON_H\n\n", prefix, prefix);
+	fprintf(out, "#include \"json.h\"\n\nextern const JSONValue * const %s;\n\n#endif\n", prefix);
+	fclose(out);
+	sprintf(path, "%s.c", argv[2]);
+	out = fopen(path, "w");
+	if (!out) {
+		fail("can't write ", path);
+	}
+	fprintf(out, "/* generated by json2c, do not edit */\n#include \"%s.h\"\n#include \"json_static.h\"\n\n", base);
+	root = write_value(value);
+	fprintf(out, "\nconst JSONValue * const %s = ", prefix);
+	write_ref(root);
+	fputs(";\n", out);
+	if (ferror(out)) {
+		fail("can't write ", path);
+	}
+	fclose(out);
+	json_free(value, allocator);
+	free(text);
+	free(shapes);
+	free(shape_ids);
+	return 0;
+}